@@ -0,0 +1,139 @@
+#ifndef CAENAGGREGATE_HH
+#define CAENAGGREGATE_HH
+#include <cstdint>
+#include <cstring>
+
+// header-only walker over the board and channel aggregates of DPP-PSD data
+// only the aggregate headers are read, so walking a buffer is O(#aggregates) and doesn't touch the event data
+
+// board aggregate header (4 words)
+struct CaenBoardAggregate {
+	const uint32_t* fData; // start of the board aggregate (first header word)
+	uint32_t fNofWords;    // number of 32-bit words including the header
+	uint8_t  fBoardId;     // GEO address of board (can be set via register 0xef08 for VME)
+	uint16_t fPattern;     // value read from LVDS I/O (VME only)
+	uint8_t  fChannelMask; // which channel pairs are in this board aggregate
+	uint32_t fCounter;     // counts the board aggregates
+	uint32_t fTime;        // time of creation of aggregate (does not correspond to a physical quantity)
+
+	// reads the header at data, returns false if there is no valid header or not enough words for the whole aggregate
+	bool Read(const uint32_t* data, uint32_t nofWords) {
+		if(nofWords < 4 || (data[0]>>28) != 0xa) return false;
+		fData        = data;
+		fNofWords    = data[0]&0xfffffff;
+		if(fNofWords < 4 || fNofWords > nofWords) return false;
+		fBoardId     = data[1]>>27;
+		fPattern     = (data[1]>>8) & 0x7fff;
+		fChannelMask = data[1]&0xff;
+		fCounter     = data[2]&0x7fffff;
+		fTime        = data[3];
+		return true;
+	}
+
+	const uint32_t* Begin() const { return fData + 4; }
+	const uint32_t* End() const { return fData + fNofWords; }
+};
+
+// channel aggregate header (2 words), one aggregate holds the events of a channel pair
+struct CaenChannelAggregate {
+	const uint32_t* fData;    // start of the channel aggregate (first header word)
+	uint32_t fNofWords;       // number of 32-bit words including the header
+	uint8_t  fChannel;        // first (even) channel of the pair
+	bool     fDualTrace;
+	bool     fExtras;
+	bool     fWaveform;
+	uint8_t  fExtraFormat;
+	uint32_t fNofSampleWords; // number of waveform words per event (two samples per word)
+	uint32_t fEventSize;      // number of words per event
+
+	// reads the header at data, returns false if the header is invalid, there are not enough words left,
+	// or the size of the aggregate isn't a multiple of the event size
+	bool Read(const uint32_t* data, uint32_t nofWords, uint8_t channel) {
+		if(nofWords < 2 || (data[0]>>31) != 0x1 || ((data[1]>>29) & 0x3) != 0x3) return false;
+		fData           = data;
+		fNofWords       = data[0]&0x3fffff;
+		if(fNofWords < 2 || fNofWords > nofWords) return false;
+		fChannel        = channel;
+		fDualTrace      = ((data[1]>>31) == 0x1);
+		fExtras         = (((data[1]>>28) & 0x1) == 0x1);
+		fWaveform       = (((data[1]>>27) & 0x1) == 0x1);
+		fExtraFormat    = ((data[1]>>24) & 0x7);
+		fNofSampleWords = fWaveform ? 4*(data[1]&0xffff) : 0; // number of samples divided by eight, 2 sample per word => 4*
+		fEventSize      = fNofSampleWords + 2; // +2 = trigger time word and charge word
+		if(fExtras) ++fEventSize;
+		return (fNofWords-2)%fEventSize == 0;
+	}
+
+	uint32_t NofEvents() const { return (fNofWords-2)/fEventSize; }
+	const uint32_t* Begin() const { return fData + 2; }
+	const uint32_t* End() const { return fData + fNofWords; }
+};
+
+// event counts of a buffer, per channel pair (indexed by the even channel) and in total
+struct CaenAggregateCounts {
+	uint32_t fNofEvents;
+	uint32_t fNofBoardAggregates;
+	uint32_t fChannelEvents[16];
+
+	void Clear() { std::memset(this, 0, sizeof(CaenAggregateCounts)); }
+	void Add(const CaenAggregateCounts& other) {
+		fNofEvents += other.fNofEvents;
+		fNofBoardAggregates += other.fNofBoardAggregates;
+		for(int ch = 0; ch < 16; ++ch) {
+			fChannelEvents[ch] += other.fChannelEvents[ch];
+		}
+	}
+};
+
+class CaenAggregate {
+public:
+	// loops over all board aggregates in data (nofWords 32-bit words) and calls boardFunc(const CaenBoardAggregate&)
+	// for each of them, and channelFunc(const CaenBoardAggregate&, const CaenChannelAggregate&) for each channel aggregate
+	// trailing empty words are ignored, returns false if the data is corrupted
+	template<typename BoardFunc, typename ChannelFunc>
+	static bool Walk(const uint32_t* data, uint32_t nofWords, BoardFunc boardFunc, ChannelFunc channelFunc) {
+		const uint32_t* end = data + nofWords;
+		CaenBoardAggregate board;
+		CaenChannelAggregate channel;
+		while(data < end) {
+			if(*data == 0x0) {
+				// empty words at the end of the buffer are fine, as long as they really are at the end
+				while(data < end) {
+					if(*data++ != 0x0) return false;
+				}
+				return true;
+			}
+			if(!board.Read(data, end - data)) return false;
+			boardFunc(board);
+			const uint32_t* w = board.Begin();
+			for(uint8_t ch = 0; ch < 16; ch += 2) {
+				if(((board.fChannelMask>>(ch/2)) & 0x1) == 0x0) continue;
+				if(!channel.Read(w, board.End() - w, ch)) return false;
+				channelFunc(board, channel);
+				w = channel.End();
+			}
+			data = board.End();
+		}
+		return true;
+	}
+
+	// counts the events in data from the aggregate headers alone
+	// if splitPairs is set, the first word of each event is read to tell the two channels of a pair apart
+	// (which is O(#events) instead of O(#aggregates))
+	static bool Count(const uint32_t* data, uint32_t nofWords, CaenAggregateCounts& counts, bool splitPairs = false) {
+		return Walk(data, nofWords,
+			[&counts](const CaenBoardAggregate&) { ++counts.fNofBoardAggregates; },
+			[&counts, splitPairs](const CaenBoardAggregate&, const CaenChannelAggregate& channel) {
+				uint32_t nofEvents = channel.NofEvents();
+				counts.fNofEvents += nofEvents;
+				if(!splitPairs) {
+					counts.fChannelEvents[channel.fChannel] += nofEvents;
+					return;
+				}
+				for(const uint32_t* w = channel.Begin(); w < channel.End(); w += channel.fEventSize) {
+					++counts.fChannelEvents[channel.fChannel + (*w>>31)]; // highest bit indicates odd channel
+				}
+			});
+	}
+};
+#endif
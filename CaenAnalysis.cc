@@ -0,0 +1,423 @@
+#include "CaenAnalysis.hh"
+
+#include <iostream>
+#include <sstream>
+#include <deque>
+
+#include "TEnv.h"
+
+#include "CaenHistogram.hh"
+
+// time-ordered hits are passed on to the ordered stages in batches of this size
+static const size_t gOrderedBatchSize = 4096;
+
+CaenAnalysisStage::CaenAnalysisStage(const std::string& name, const std::vector<int>& channels)
+	: fName(name), fChannels(channels)
+{
+	for(size_t i = 0; i < fChannels.size(); ++i) {
+		if(fChannels[i] >= static_cast<int>(fIndex.size())) {
+			fIndex.resize(fChannels[i] + 1, -1);
+		}
+		fIndex[fChannels[i]] = i;
+	}
+}
+
+namespace {
+	std::string ChannelName(const std::string& name, int channel)
+	{
+		return name + "_" + std::to_string(channel);
+	}
+
+	// channel numbers, hits of channels that aren't used go to the overflow bin
+	// written as TH1F like the channels histogram always was, so existing macros can still read it
+	class ChannelsStage : public CaenAnalysisStage {
+	public:
+		ChannelsStage(const std::string& name, const std::vector<int>& channels, int nofThreads, int nofBins, double low, double high)
+			: CaenAnalysisStage(name, channels), fOverflow(high), fHistograms(nofThreads, CaenHistogram1D(name, "channel number", nofBins, low, high)) {}
+
+		void Process(int thread, CaenSpan<CaenHit> hits, int weight) {
+			for(const auto& hit : hits) {
+				fHistograms[thread].Fill(Index(hit.Channel()) < 0 ? fOverflow : hit.Channel(), weight);
+			}
+		}
+		void AddTo(TList* list) {
+			for(size_t i = 1; i < fHistograms.size(); ++i) {
+				fHistograms[0].Add(fHistograms[i]);
+			}
+			list->Add(fHistograms[0].CreateRootHistogram<TH1F>());
+		}
+
+	private:
+		double fOverflow;
+		std::vector<CaenHistogram1D> fHistograms; // per thread
+	};
+
+	// charge (x) vs. channel (y) of all channels in one histogram, like the channels histogram as TH2F and with
+	// the hits of channels that aren't used in the overflow
+	class ChargeVsChannelStage : public CaenAnalysisStage {
+	public:
+		ChargeVsChannelStage(const std::string& name, const std::vector<int>& channels, int nofThreads, int nofBins, double low, double high, int nofChannelBins, double channelLow, double channelHigh)
+			: CaenAnalysisStage(name, channels), fOverflow(channelHigh), fHistograms(nofThreads, CaenHistogram2D(name, name, nofBins, low, high, nofChannelBins, channelLow, channelHigh)) {}
+
+		void Process(int thread, CaenSpan<CaenHit> hits, int weight) {
+			for(const auto& hit : hits) {
+				fHistograms[thread].Fill(hit.Charge(), Index(hit.Channel()) < 0 ? fOverflow : hit.Channel(), weight);
+			}
+		}
+		void AddTo(TList* list) {
+			for(size_t i = 1; i < fHistograms.size(); ++i) {
+				fHistograms[0].Add(fHistograms[i]);
+			}
+			list->Add(fHistograms[0].CreateRootHistogram<TH2F>());
+		}
+
+	private:
+		double fOverflow;
+		std::vector<CaenHistogram2D> fHistograms; // per thread
+	};
+
+	// charge or short gate spectrum of each channel
+	class SpectrumStage : public CaenAnalysisStage {
+	public:
+		SpectrumStage(const std::string& name, const std::vector<int>& channels, int nofThreads, bool shortGate, int nofBins, double low, double high)
+			: CaenAnalysisStage(name, channels), fShortGate(shortGate), fHistograms(nofThreads)
+		{
+			for(auto& histograms : fHistograms) {
+				for(int channel : fChannels) {
+					histograms.emplace_back(ChannelName(name, channel), ChannelName(name, channel) + (fShortGate ? " short gate" : " charge"), nofBins, low, high);
+				}
+			}
+		}
+
+		void Process(int thread, CaenSpan<CaenHit> hits, int weight) {
+			auto& histograms = fHistograms[thread];
+			for(const auto& hit : hits) {
+				int index = Index(hit.Channel());
+				if(index < 0) continue;
+				histograms[index].Fill(fShortGate ? hit.ShortGate() : hit.Charge(), weight);
+			}
+		}
+		void AddTo(TList* list) {
+			for(size_t c = 0; c < fChannels.size(); ++c) {
+				for(size_t i = 1; i < fHistograms.size(); ++i) {
+					fHistograms[0][c].Add(fHistograms[i][c]);
+				}
+				list->Add(fHistograms[0][c].CreateRootHistogram());
+			}
+		}
+
+	private:
+		bool fShortGate;
+		std::vector<std::vector<CaenHistogram1D> > fHistograms; // per thread and channel
+	};
+
+	// pulse shape discrimination: charge (x) vs. tail fraction (charge - short gate)/charge (y) of each channel
+	class PsdStage : public CaenAnalysisStage {
+	public:
+		PsdStage(const std::string& name, const std::vector<int>& channels, int nofThreads, int nofBins, double low, double high, int nofPsdBins)
+			: CaenAnalysisStage(name, channels), fHistograms(nofThreads)
+		{
+			for(auto& histograms : fHistograms) {
+				for(int channel : fChannels) {
+					histograms.emplace_back(ChannelName(name, channel), ChannelName(name, channel) + " PSD vs. charge", nofBins, low, high, nofPsdBins, 0., 1.);
+				}
+			}
+		}
+
+		void Process(int thread, CaenSpan<CaenHit> hits, int weight) {
+			auto& histograms = fHistograms[thread];
+			for(const auto& hit : hits) {
+				int index = Index(hit.Channel());
+				if(index < 0) continue;
+				// hits without charge end up in the underflow
+				double psd = hit.Charge() > 0 ? (static_cast<double>(hit.Charge()) - hit.ShortGate())/hit.Charge() : -1.;
+				histograms[index].Fill(hit.Charge(), psd, weight);
+			}
+		}
+		void AddTo(TList* list) {
+			for(size_t c = 0; c < fChannels.size(); ++c) {
+				for(size_t i = 1; i < fHistograms.size(); ++i) {
+					fHistograms[0][c].Add(fHistograms[i][c]);
+				}
+				list->Add(fHistograms[0][c].CreateRootHistogram());
+			}
+		}
+
+	private:
+		std::vector<std::vector<CaenHistogram2D> > fHistograms; // per thread and channel
+	};
+
+	// time of each channel minus the time of the reference channel, for all pairs within the histogram range
+	class TimeDifferenceStage : public CaenAnalysisStage {
+	public:
+		TimeDifferenceStage(const std::string& name, const std::vector<int>& channels, int reference, int nofBins, double low, double high)
+			: CaenAnalysisStage(name, channels), fReference(reference),
+			  fLow(static_cast<int64_t>(low*1000.)), fHigh(static_cast<int64_t>(high*1000.))
+		{
+			for(int channel : fChannels) {
+				fHistograms.emplace_back(ChannelName(name, channel), ChannelName(name, channel) + " - channel " + std::to_string(reference) + " [ns]", nofBins, low, high);
+			}
+		}
+
+		int Reference() const { return fReference; }
+
+		bool Ordered() const { return true; }
+		void ProcessOrdered(CaenSpan<CaenHit> hits, CaenSpan<uint64_t> times) {
+			for(size_t i = 0; i < hits.size(); ++i) {
+				int64_t time = times[i];
+				// drop the hits that are too old to be paired with this or any later hit, on every hit,
+				// so neither queue grows if one side is silent
+				while(!fOthers.empty() && time - fOthers.front().second > -fLow) fOthers.pop_front();
+				while(!fReferences.empty() && time - fReferences.front() > fHigh) fReferences.pop_front();
+				if(hits[i].Channel() == fReference) {
+					// pairs with the earlier hits of the other channels
+					for(const auto& other : fOthers) {
+						fHistograms[Index(other.first)].Fill((other.second - time)/1000., 1);
+					}
+					fReferences.push_back(time);
+				} else {
+					int index = Index(hits[i].Channel());
+					if(index < 0) continue;
+					// pairs with the earlier hits of the reference channel
+					for(int64_t reference : fReferences) {
+						fHistograms[index].Fill((time - reference)/1000., 1);
+					}
+					fOthers.push_back(std::make_pair(hits[i].Channel(), time));
+				}
+			}
+		}
+		void AddTo(TList* list) {
+			for(auto& histogram : fHistograms) {
+				list->Add(histogram.CreateRootHistogram());
+			}
+		}
+
+	private:
+		int fReference;
+		int64_t fLow;  // in ps
+		int64_t fHigh; // in ps
+		std::deque<int64_t> fReferences;              // times of the recent hits of the reference channel
+		std::deque<std::pair<int, int64_t> > fOthers; // channels and times of the recent hits of the other channels
+		std::vector<CaenHistogram1D> fHistograms;     // per channel
+	};
+
+	// hits per time bin of each channel, from the first hit on
+	class RateStage : public CaenAnalysisStage {
+	public:
+		RateStage(const std::string& name, const std::vector<int>& channels, double binWidth, double length)
+			: CaenAnalysisStage(name, channels), fStarted(false), fStart(0)
+		{
+			int nofBins = static_cast<int>(length/binWidth + 0.5);
+			for(int channel : fChannels) {
+				fHistograms.emplace_back(ChannelName(name, channel), ChannelName(name, channel) + " hits per " + std::to_string(binWidth) + " s", nofBins, 0., nofBins*binWidth);
+			}
+		}
+
+		bool Ordered() const { return true; }
+		void ProcessOrdered(CaenSpan<CaenHit> hits, CaenSpan<uint64_t> times) {
+			if(!fStarted && !hits.empty()) {
+				fStart = times[0];
+				fStarted = true;
+			}
+			for(size_t i = 0; i < hits.size(); ++i) {
+				int index = Index(hits[i].Channel());
+				if(index < 0) continue;
+				fHistograms[index].Fill((times[i] - fStart)*1e-12, 1);
+			}
+		}
+		void AddTo(TList* list) {
+			for(auto& histogram : fHistograms) {
+				list->Add(histogram.CreateRootHistogram());
+			}
+		}
+
+	private:
+		bool fStarted;
+		uint64_t fStart; // in ps
+		std::vector<CaenHistogram1D> fHistograms; // per channel
+	};
+}
+
+CaenAnalysis::CaenAnalysis(int nofThreads, int nofChannels)
+	: fNofThreads(nofThreads), fNofChannels(nofChannels), fConverted(nofThreads)
+{
+	std::vector<int> allChannels;
+	for(int channel = 0; channel < fNofChannels; ++channel) {
+		allChannels.push_back(channel);
+	}
+	fStages.emplace_back(new ChannelsStage("channels", allChannels, fNofThreads, fNofChannels+1, 0, fNofChannels+1));
+	fStages.emplace_back(new ChargeVsChannelStage("channelVsCharge", allChannels, fNofThreads, 5000, 0, 50000, fNofChannels+1, 0, fNofChannels+1));
+}
+
+bool CaenAnalysis::ReadConfig(const std::string& fileName)
+{
+	// TEnv(name) would also read the files of that name from $ROOTSYS/etc and $HOME, so only the file itself is read
+	TEnv config;
+	if(config.ReadFile(fileName.c_str(), kEnvLocal) != 0) {
+		std::cerr<<"Failed to read analysis config file "<<fileName<<std::endl;
+		return false;
+	}
+
+	std::vector<std::unique_ptr<CaenAnalysisStage> > stages;
+	std::istringstream stageNames(config.GetValue("Stages", ""));
+	std::string name;
+	while(stageNames>>name) {
+		std::string type = config.GetValue(Form("%s.Type", name.c_str()), "");
+
+		// channels of this stage, all by default
+		std::vector<int> channels;
+		std::istringstream channelList(config.GetValue(Form("%s.Channels", name.c_str()), ""));
+		int channel;
+		while(channelList>>channel) {
+			if(channel < 0 || channel >= 16) {
+				std::cerr<<"stage "<<name<<": channel "<<channel<<" is out of range"<<std::endl;
+				return false;
+			}
+			channels.push_back(channel);
+		}
+		if(channels.empty()) {
+			for(channel = 0; channel < fNofChannels; ++channel) {
+				channels.push_back(channel);
+			}
+		}
+
+		int nofBins = config.GetValue(Form("%s.Bins", name.c_str()), 5000);
+		double low  = config.GetValue(Form("%s.Low", name.c_str()), 0.);
+		double high = config.GetValue(Form("%s.High", name.c_str()), 50000.);
+		if(type == "Channels") {
+			stages.emplace_back(new ChannelsStage(name, channels, fNofThreads, fNofChannels+1, 0, fNofChannels+1));
+		} else if(type == "ChargeVsChannel") {
+			stages.emplace_back(new ChargeVsChannelStage(name, channels, fNofThreads, nofBins, low, high, fNofChannels+1, 0, fNofChannels+1));
+		} else if(type == "Spectrum") {
+			std::string quantity = config.GetValue(Form("%s.Quantity", name.c_str()), "Charge");
+			if(quantity != "Charge" && quantity != "ShortGate") {
+				std::cerr<<"stage "<<name<<": unknown quantity "<<quantity<<", should be Charge or ShortGate"<<std::endl;
+				return false;
+			}
+			stages.emplace_back(new SpectrumStage(name, channels, fNofThreads, quantity == "ShortGate", nofBins, low, high));
+		} else if(type == "PSD") {
+			int nofPsdBins = config.GetValue(Form("%s.PsdBins", name.c_str()), 200);
+			stages.emplace_back(new PsdStage(name, channels, fNofThreads, nofBins, low, high, nofPsdBins));
+		} else if(type == "TimeDifference") {
+			int reference = config.GetValue(Form("%s.Reference", name.c_str()), 0);
+			nofBins = config.GetValue(Form("%s.Bins", name.c_str()), 2000);
+			low  = config.GetValue(Form("%s.Low", name.c_str()), -1000.);
+			high = config.GetValue(Form("%s.High", name.c_str()), 1000.);
+			if(low > 0. || high < 0.) {
+				std::cerr<<"stage "<<name<<": time difference range "<<low<<" - "<<high<<" ns has to include zero"<<std::endl;
+				return false;
+			}
+			// the reference channel itself is not a channel of this stage
+			for(auto it = channels.begin(); it != channels.end(); ++it) {
+				if(*it == reference) {
+					channels.erase(it);
+					break;
+				}
+			}
+			stages.emplace_back(new TimeDifferenceStage(name, channels, reference, nofBins, low, high));
+		} else if(type == "Rate") {
+			double binWidth = config.GetValue(Form("%s.BinWidth", name.c_str()), 1.);
+			double length   = config.GetValue(Form("%s.Length", name.c_str()), 3600.);
+			if(binWidth <= 0. || length < binWidth) {
+				std::cerr<<"stage "<<name<<": bin width "<<binWidth<<" s and length "<<length<<" s are not possible"<<std::endl;
+				return false;
+			}
+			stages.emplace_back(new RateStage(name, channels, binWidth, length));
+		} else {
+			std::cerr<<"stage "<<name<<": unknown type '"<<type<<"'"<<std::endl;
+			return false;
+		}
+	}
+	if(stages.empty()) {
+		std::cerr<<"No analysis stages in "<<fileName<<std::endl;
+		return false;
+	}
+
+	fStages.swap(stages);
+	return true;
+}
+
+void CaenAnalysis::Process(int thread, CaenSpan<CaenHit> hits, int weight)
+{
+	for(auto& stage : fStages) {
+		stage->Process(thread, hits, weight);
+	}
+}
+
+void CaenAnalysis::Process(int thread, CaenSpan<CaenEvent> events, int weight)
+{
+	auto& hits = fConverted[thread];
+	hits.resize(events.size());
+	for(size_t i = 0; i < events.size(); ++i) {
+		hits[i] = events[i].Hit();
+	}
+	Process(thread, CaenSpan<CaenHit>(hits), weight);
+}
+
+bool CaenAnalysis::Ordered() const
+{
+	for(const auto& stage : fStages) {
+		if(stage->Ordered()) return true;
+	}
+	return false;
+}
+
+void CaenAnalysis::AddOrdered(const CaenHit& hit, uint64_t time)
+{
+	fOrderedHits.push_back(hit);
+	fOrderedTimes.push_back(time);
+	if(fOrderedHits.size() >= gOrderedBatchSize) {
+		Flush();
+	}
+}
+
+void CaenAnalysis::Flush()
+{
+	if(fOrderedHits.empty()) return;
+	for(auto& stage : fStages) {
+		if(stage->Ordered()) {
+			stage->ProcessOrdered(CaenSpan<CaenHit>(fOrderedHits), CaenSpan<uint64_t>(fOrderedTimes));
+		}
+	}
+	fOrderedHits.clear();
+	fOrderedTimes.clear();
+}
+
+uint16_t CaenAnalysis::ChannelMask() const
+{
+	uint16_t mask = 0;
+	for(const auto& stage : fStages) {
+		for(int channel : stage->Channels()) {
+			mask |= 1<<channel;
+		}
+		// the channel histograms put every hit of an unlisted channel in their overflow bin, so they need all channels
+		if(dynamic_cast<const ChannelsStage*>(stage.get()) != nullptr || dynamic_cast<const ChargeVsChannelStage*>(stage.get()) != nullptr) {
+			return 0xffff;
+		}
+		// the time differences also need the reference channel
+		auto timeDifference = dynamic_cast<const TimeDifferenceStage*>(stage.get());
+		if(timeDifference != nullptr) {
+			mask |= 1<<timeDifference->Reference();
+		}
+	}
+	return mask;
+}
+
+void CaenAnalysis::AddTo(TList* list)
+{
+	for(auto& stage : fStages) {
+		stage->AddTo(list);
+	}
+}
+
+void CaenAnalysis::Print() const
+{
+	std::cout<<"analysis stages:"<<std::endl;
+	for(const auto& stage : fStages) {
+		std::cout<<"  "<<stage->Name()<<(stage->Ordered() ? " (time ordered)" : "")<<", channels";
+		for(int channel : stage->Channels()) {
+			std::cout<<" "<<channel;
+		}
+		std::cout<<std::endl;
+	}
+}
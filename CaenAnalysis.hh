@@ -0,0 +1,89 @@
+#ifndef CAENANALYSIS_HH
+#define CAENANALYSIS_HH
+#include <vector>
+#include <string>
+#include <memory>
+#include <cstdint>
+
+#include "TList.h"
+
+#include "CaenHit.hh"
+#include "CaenEvent.hh"
+#include "CaenSpan.hh"
+
+// one step of the online analysis, filling its histograms from batches of hits
+// unordered stages get the hits of each decoded segment from the decoding threads, each thread has its own histograms,
+// and hits of segments that are rejected later are passed again with weight -1
+// ordered stages (e.g. time differences) get the time-sorted hits together with their unwrapped time in ps from the output thread
+class CaenAnalysisStage {
+public:
+	CaenAnalysisStage(const std::string& name, const std::vector<int>& channels);
+	virtual ~CaenAnalysisStage() {}
+
+	virtual bool Ordered() const { return false; }
+	virtual void Process(int, CaenSpan<CaenHit>, int) {}
+	virtual void ProcessOrdered(CaenSpan<CaenHit>, CaenSpan<uint64_t>) {}
+	// merges the histograms of all threads and adds them as ROOT histograms to the list
+	virtual void AddTo(TList* list) = 0;
+
+	const std::string& Name() const { return fName; }
+	const std::vector<int>& Channels() const { return fChannels; }
+
+protected:
+	// index of the channel in the channels of this stage, or -1 if the stage doesn't use it
+	int Index(int channel) const { return (channel >= 0 && channel < static_cast<int>(fIndex.size())) ? fIndex[channel] : -1; }
+
+	std::string fName;
+	std::vector<int> fChannels;
+	std::vector<int> fIndex;
+};
+
+// the stages of the online analysis, either the default ones (channels and channelVsCharge histograms)
+// or the ones from a config file (TEnv format), e.g.
+//   Stages: spectra psd tdiff rate
+//   spectra.Type: Spectrum                (one 1D histogram per channel, name_<channel>)
+//   spectra.Channels: 0 1 2 3             (default all channels)
+//   spectra.Quantity: Charge              (Charge or ShortGate)
+//   spectra.Bins: 5000                    (spectra.Low and spectra.High default to 0 and 50000)
+//   psd.Type: PSD                         (charge vs. (charge - short gate)/charge per channel, PsdBins from 0 to 1, default 200)
+//   tdiff.Type: TimeDifference            (time of each channel minus the one of the reference channel, in ns,
+//   tdiff.Reference: 0                     for all pairs within Low and High, default -1000 to 1000 ns)
+//   rate.Type: Rate                       (hits per BinWidth seconds (default 1) for Length seconds (default 3600) per channel)
+// further types are Channels (channel numbers) and ChargeVsChannel, written as TH1F/TH2F like the default histograms,
+// with the hits of all other channels in the overflow
+class CaenAnalysis {
+public:
+	// nofThreads is the number of threads that call Process (CaenPipeline::NofBatchThreads)
+	CaenAnalysis(int nofThreads, int nofChannels);
+	~CaenAnalysis() {}
+
+	// replaces the stages with the ones from the file, returns false if the file can't be read or has errors
+	bool ReadConfig(const std::string& fileName);
+
+	void Process(int thread, CaenSpan<CaenHit> hits, int weight);
+	// events are converted to compact hits first, none of the stages needs the waveforms
+	void Process(int thread, CaenSpan<CaenEvent> events, int weight);
+
+	// whether any stage needs the time-ordered hits, which are then passed one by one to AddOrdered, and Flush at the end
+	bool Ordered() const;
+	void AddOrdered(const CaenHit& hit, uint64_t time);
+	void Flush();
+
+	// channels used by any stage, all of them if the channel histograms are filled
+	uint16_t ChannelMask() const;
+
+	void AddTo(TList* list);
+	void Print() const;
+
+private:
+	CaenAnalysis(const CaenAnalysis&) = delete;
+	CaenAnalysis& operator=(const CaenAnalysis&) = delete;
+
+	int fNofThreads;
+	int fNofChannels;
+	std::vector<std::unique_ptr<CaenAnalysisStage> > fStages;
+	std::vector<std::vector<CaenHit> > fConverted; // per thread, for the conversion of events to hits
+	std::vector<CaenHit> fOrderedHits;
+	std::vector<uint64_t> fOrderedTimes;
+};
+#endif
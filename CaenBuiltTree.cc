@@ -0,0 +1,38 @@
+#include "CaenBuiltTree.hh"
+
+// same cluster and basket sizes as the flat tree
+static const Long64_t gBuiltClusterBytes = 32*1024*1024;
+static const int gBuiltBasketSize = 256*1024;
+
+CaenBuiltTree::CaenBuiltTree(TTree* tree)
+	: fTree(tree), fMultiplicity(0)
+{
+	fTree->SetAutoFlush(-gBuiltClusterBytes);
+	fTree->Branch("multiplicity", &fMultiplicity, "multiplicity/i", gBuiltBasketSize);
+	fChannel.fBranch   = fTree->Branch("channel", fChannel.fValues.data(), "channel[multiplicity]/b", gBuiltBasketSize);
+	fTimestamp.fBranch = fTree->Branch("timestamp", fTimestamp.fValues.data(), "timestamp[multiplicity]/l", gBuiltBasketSize);
+	fCfd.fBranch       = fTree->Branch("cfd", fCfd.fValues.data(), "cfd[multiplicity]/s", gBuiltBasketSize);
+	fCharge.fBranch    = fTree->Branch("charge", fCharge.fValues.data(), "charge[multiplicity]/s", gBuiltBasketSize);
+	fShortGate.fBranch = fTree->Branch("shortGate", fShortGate.fValues.data(), "shortGate[multiplicity]/s", gBuiltBasketSize);
+	fFlags.fBranch     = fTree->Branch("flags", fFlags.fValues.data(), "flags[multiplicity]/b", gBuiltBasketSize);
+}
+
+void CaenBuiltTree::Fill(const std::vector<CaenHit>& hits)
+{
+	fMultiplicity = hits.size();
+	fChannel.Resize(fMultiplicity);
+	fTimestamp.Resize(fMultiplicity);
+	fCfd.Resize(fMultiplicity);
+	fCharge.Resize(fMultiplicity);
+	fShortGate.Resize(fMultiplicity);
+	fFlags.Resize(fMultiplicity);
+	for(size_t i = 0; i < hits.size(); ++i) {
+		fChannel.fValues[i]   = hits[i].fChannel;
+		fTimestamp.fValues[i] = hits[i].GetTimestamp();
+		fCfd.fValues[i]       = hits[i].fCfd;
+		fCharge.fValues[i]    = hits[i].fCharge;
+		fShortGate.fValues[i] = hits[i].fShortGate;
+		fFlags.fValues[i]     = hits[i].fFlags;
+	}
+	fTree->Fill();
+}
@@ -0,0 +1,47 @@
+#ifndef CAENBUILTTREE_HH
+#define CAENBUILTTREE_HH
+#include <vector>
+#include <cstdint>
+
+#include "TTree.h"
+
+#include "CaenHit.hh"
+
+// writes built events (see CaenEventBuilder), one entry per event with the quantities of all its hits as arrays
+// branches:
+// multiplicity/i, and with multiplicity entries each (in time order):
+// channel/b, timestamp/l (extended timestamp and trigger time combined), cfd/s, charge/s, shortGate/s, flags/b (CaenHit::EFlags)
+class CaenBuiltTree {
+public:
+	CaenBuiltTree(TTree* tree);
+	~CaenBuiltTree() {}
+
+	void Fill(const std::vector<CaenHit>& hits);
+
+private:
+	// one array branch, the branch address is set again if the vector had to grow
+	template<typename T>
+	struct Column {
+		std::vector<T> fValues;
+		TBranch* fBranch;
+
+		Column() : fValues(1), fBranch(nullptr) {}
+		void Resize(size_t size) {
+			if(size > fValues.size()) {
+				fValues.resize(size);
+				fBranch->SetAddress(fValues.data());
+			}
+		}
+	};
+
+	TTree* fTree;
+
+	uint32_t fMultiplicity;
+	Column<uint8_t>  fChannel;
+	Column<uint64_t> fTimestamp;
+	Column<uint16_t> fCfd;
+	Column<uint16_t> fCharge;
+	Column<uint16_t> fShortGate;
+	Column<uint8_t>  fFlags;
+};
+#endif
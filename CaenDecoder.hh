@@ -0,0 +1,328 @@
+#ifndef CAENDECODER_HH
+#define CAENDECODER_HH
+#include <iostream>
+#include <iomanip>
+#include <cstdint>
+#include <type_traits>
+
+#include "CaenEvent.hh"
+#include "CaenHit.hh"
+#include "CaenUnpack.hh"
+
+// streaming decoder for DPP-PSD data
+// instead of returning a list of newly allocated events, every decoded hit is handed to a sink
+// (any callable taking a const CaenEvent&, or a const CaenHit& for DecodeHits), the event is owned by the decoder and re-used for the next hit,
+// so there is no allocation per hit once the waveform vectors have reached their size
+// the board counter check is part of the decoder, so each stream of data needs its own decoder
+class CaenDecoder {
+public:
+	// what to decode, anything skipped is jumped over using the sizes from the channel aggregate header
+	struct Options {
+		bool fSkipWaveforms;     // no analog or digital waveforms, only the scalar quantities
+		bool fSkipDigitalProbes; // analog waveforms only
+		uint16_t fChannelMask;   // channels to decode, a channel aggregate without any of them isn't looked at
+
+		Options() : fSkipWaveforms(false), fSkipDigitalProbes(false), fChannelMask(0xffff) {}
+	};
+
+	CaenDecoder(int debug = 0, const Options& options = Options()) : fDebug(debug), fOptions(options), fBoardCounter(0), fFirstBoardCounter(0), fNofBoardAggregates(0), fBoardId(0) {}
+
+	void SetOptions(const Options& options) { fOptions = options; }
+	const Options& GetOptions() const { return fOptions; }
+
+	// decodes nofWords 32-bit words and calls sink(const CaenEvent&) for each hit
+	// returns false if the data is corrupted, all hits up to that point have been passed to the sink
+	template<typename Sink>
+	bool Decode(const uint32_t* data, int nofWords, Sink&& sink) { return DecodeData<false>(data, nofWords, sink); }
+	// same as Decode, but calls sink(const CaenHit&) with the compact hit, waveforms are skipped
+	template<typename Sink>
+	bool DecodeHits(const uint32_t* data, int nofWords, Sink&& sink) { return DecodeData<true>(data, nofWords, sink); }
+
+	// the event handed to the sink, e.g. to use as branch address
+	CaenEvent* Event() { return &fEvent; }
+	CaenHit* Hit() { return &fHit; }
+
+	uint32_t BoardCounter() const { return fBoardCounter; }
+	void ResetBoardCounter() { fBoardCounter = 0; }
+	// board counter of the first board aggregate and number of board aggregates accepted in the last call to Decode
+	uint32_t FirstBoardCounter() const { return fFirstBoardCounter; }
+	uint32_t NofBoardAggregates() const { return fNofBoardAggregates; }
+
+private:
+	enum EWaveformMode { kNoWaveform, kSingleTrace, kDualTrace, kNofWaveformModes };
+	enum EExtrasMode { kNoExtras, kExtrasFormat0, kExtrasFormat1, kExtrasFormat2, kExtrasDebugWord, kExtrasIgnored, kNofExtrasModes };
+
+	// decodes nofEvents events of one channel aggregate, the format is fixed at compile time,
+	// so the loop has a fixed stride and no branches on the format
+	// with HitsOnly only the compact hit is filled and passed to the sink, the waveforms are skipped
+	template<int WaveformMode, int ExtrasMode, bool HitsOnly, typename Sink>
+	void DecodeEvents(const uint32_t* data, int nofEvents, int numSampleWords, uint8_t channel, Sink& sink);
+
+	// passes the compact hit to the sink (HitsOnly), or fills the event from it and the waveform words at samples and passes that on
+	template<int WaveformMode, typename Sink>
+	void Emit(const uint32_t* samples, int numSampleWords, Sink& sink, std::true_type hitsOnly);
+	template<int WaveformMode, typename Sink>
+	void Emit(const uint32_t* samples, int numSampleWords, Sink& sink, std::false_type hitsOnly);
+
+	// decoding of the aggregate headers, shared by Decode and DecodeHits
+	template<bool HitsOnly, typename Sink>
+	bool DecodeData(const uint32_t* data, int nofWords, Sink& sink);
+
+	// table of all event loops for a sink type, indexed by waveform and extras mode
+	template<bool HitsOnly, typename Sink>
+	struct EventLoops {
+		typedef void (CaenDecoder::*EventLoop)(const uint32_t*, int, int, uint8_t, Sink&);
+		static const EventLoop fTable[kNofWaveformModes][kNofExtrasModes];
+	};
+
+	void PrintWord(int w, uint32_t word) const {
+		std::cout<<w<<" - 0x"<<std::hex<<std::setw(8)<<std::setfill('0')<<word<<std::dec<<std::setfill(' ')<<std::endl;
+	}
+
+	int fDebug;
+	Options fOptions;
+	uint32_t fBoardCounter;
+	uint32_t fFirstBoardCounter;
+	uint32_t fNofBoardAggregates;
+	uint8_t fBoardId; // of the board aggregate being decoded
+	CaenEvent fEvent;
+	CaenHit fHit;
+};
+
+template<bool HitsOnly, typename Sink>
+bool CaenDecoder::DecodeData(const uint32_t* data, int bankSize, Sink& sink)
+{
+	if(fDebug > 4) {
+		std::cout<<"starting to read bank "<<static_cast<const void*>(data)<<" of size "<<bankSize<<std::endl;
+	}
+
+	fNofBoardAggregates = 0;
+	int w = 0;
+	for(int board = 0; w < bankSize; ++board) {
+		if(fDebug > 5) {
+			std::cout<<"----------------------------------------"<<std::endl;
+			PrintWord(w, data[w]);
+		}
+		// read board aggregate header
+		if(data[w]>>28 != 0xa) {
+			if(data[w] == 0x0) {
+				while(w < bankSize) {
+					if(data[w++] != 0x0) {
+						std::cerr<<board<<". board - failed on first word, found empty word, but not all following words were empty: "<<w-1<<" 0x"<<std::hex<<std::setw(8)<<std::setfill('0')<<data[w-1]<<std::dec<<std::setfill(' ')<<std::endl;
+						return false;
+					}
+				}
+				return true;
+			}
+			std::cerr<<board<<". board - failed on first word 0x"<<std::hex<<std::setw(8)<<std::setfill('0')<<data[w]<<std::dec<<std::setfill(' ')<<", highest nibble should have been 0xa!"<<std::endl;
+			return false;
+		}
+		int32_t numWordsBoard = data[w++]&0xfffffff; // this is the number of 32-bit words from this board
+		if(w - 1 + numWordsBoard > bankSize) {
+			std::cerr<<"0 - Missing words, at word "<<w-1<<", expecting "<<numWordsBoard<<" more words for board "<<board<<" (bank size "<<bankSize<<")"<<std::endl;
+			return false;
+		}
+		int boardEnd = w - 1 + numWordsBoard;
+		uint8_t boardId = data[w]>>27; // GEO address of board (can be set via register 0xef08 for VME)
+		uint16_t pattern = (data[w]>>8) & 0x7fff; // value read from LVDS I/O (VME only)
+		uint8_t channelMask = data[w++]&0xff; // which channels are in this board aggregate
+		uint32_t boardCounter = data[w++]&0x7fffff; // ??? "counts the board aggregate"
+		uint32_t boardTime = data[w++]; // time of creation of aggregate (does not correspond to a physical quantity)
+		if(fDebug > 5) {
+			std::cout<<"pattern 0x"<<std::hex<<std::setw(8)<<std::setfill('0')<<pattern<<std::dec<<std::setfill(' ')<<", counter "<<boardCounter<<", time "<<boardTime<<", board ID "<<static_cast<int>(boardId)<<std::endl;
+			std::cout<<"channel mask 0x"<<std::hex<<std::setw(8)<<std::setfill('0')<<static_cast<int>(channelMask)<<std::dec<<std::setfill(' ')<<std::endl;
+		}
+		if(boardCounter < fBoardCounter) {
+			std::cerr<<"current board counter "<<boardCounter<<" is less than previous one "<<fBoardCounter<<", skipping this data"<<std::endl;
+			return false;
+		}
+		fBoardCounter = boardCounter;
+		fBoardId = boardId;
+		if(fNofBoardAggregates++ == 0) fFirstBoardCounter = boardCounter;
+
+		for(uint8_t channel = 0; channel < 16; channel += 2) {
+			if(((channelMask>>(channel/2)) & 0x1) == 0x0) {
+				if(fDebug > 5) {
+					std::cout<<"skipping dual channel "<<static_cast<int>(channel)<<std::endl;
+				}
+				continue;
+			}
+			// read channel aggregate header
+			if(data[w]>>31 != 0x1) {
+				std::cerr<<"Failed on first word 0x"<<std::hex<<std::setw(8)<<std::setfill('0')<<data[w]<<std::dec<<std::setfill(' ')<<", highest bit should have been set!"<<std::endl;
+				return false;
+			}
+			int32_t numWords = data[w++]&0x3fffff;//per channel
+			if(fDebug > 6) {
+				PrintWord(w, data[w]);
+			}
+			if(w >= bankSize) {
+				std::cerr<<"1 - Missing words, got only "<<w-1<<" words for channel "<<channel<<" (bank size "<<bankSize<<")"<<std::endl;
+				return false;
+			}
+			if(((data[w]>>29) & 0x3) != 0x3) {
+				std::cerr<<"Failed on second word 0x"<<std::hex<<std::setw(8)<<std::setfill('0')<<data[w]<<std::dec<<std::setfill(' ')<<", bits 29 and 30 should have been set!"<<std::endl;
+				return false;
+			}
+			bool dualTrace = ((data[w]>>31) == 0x1);
+			bool extras    = (((data[w]>>28) & 0x1) == 0x1);
+			bool waveform  = (((data[w]>>27) & 0x1) == 0x1);
+			uint8_t extraFormat = ((data[w]>>24) & 0x7);
+			//for now we ignore the information which traces are stored:
+			//bits 22,23: if(dualTrace) 00 = "Input and baseline", 01 = "CFD and Baseline", 10 = "Input and CFD"
+			//            else          00 = "Input", 01 = "CFD"
+			//bits 19,20,21: 000 = "Long gate",  001 = "over thres.", 010 = "shaped TRG", 011 = "TRG Val. Accept. Win.", 100 = "Pile Up", 101 = "Coincidence", 110 = reserved, 111 = "Trigger"
+			//bits 16,17,18: 000 = "Short gate", 001 = "over thres.", 010 = "TRG valid.", 011 = "TRG HoldOff",           100 = "Pile Up", 101 = "Coincidence", 110 = reserved, 111 = "Trigger"
+			int numSampleWords = waveform ? 4*(data[w]&0xffff) : 0;// this is actually the number of samples divided by eight, 2 sample per word => 4*
+			++w;
+			if(w >= bankSize) {
+				std::cerr<<"2 - Missing words, got only "<<w-1<<" words for channel "<<channel<<" (bank size "<<bankSize<<")"<<std::endl;
+				return false;
+			}
+			int eventSize = numSampleWords+2; // +2 = trigger time words and charge word
+			if(extras) ++eventSize;
+			if(fDebug > 5) {
+				std::cout<<"supposed to have "<<numWords<<" words in this channel, "<<(waveform?"w/":"w/o")<<" waveform(s), "<<(dualTrace?"w/":"w/o")<<" dual trace, "<<(extras?"w/":"w/o")<<" extras in format "<<static_cast<uint16_t>(extraFormat)<<", with "<<numSampleWords<<" sample words, at word "<<w<<"/"<<bankSize<<", event size "<<eventSize<<" => "<<(numWords-2)/eventSize<<" events"<<std::endl;
+			}
+			if(numWords < 2 || (numWords-2)%eventSize != 0) {
+				std::cerr<<numWords<<" words in channel aggregate, event size is "<<eventSize<<" => "<<static_cast<double>(numWords-2.)/static_cast<double>(eventSize)<<" events?"<<std::endl;
+				return false;
+			}
+
+			if(w - 2 + numWords > boardEnd) {
+				std::cerr<<"3 - Missing words, channel aggregate of "<<numWords<<" words for channel "<<static_cast<int>(channel)<<" at word "<<w-2<<" exceeds board aggregate ending at word "<<boardEnd<<std::endl;
+				return false;
+			}
+			if(fDebug > 6) {
+				for(int i = w; i < w - 2 + numWords; ++i) {
+					PrintWord(i, data[i]);
+				}
+			}
+
+			if(((fOptions.fChannelMask>>channel) & 0x3) == 0x0) {
+				if(fDebug > 5) {
+					std::cout<<"skipping masked dual channel "<<static_cast<int>(channel)<<std::endl;
+				}
+				w += numWords - 2;
+				continue;
+			}
+
+			// read channel data with the event loop for this format, the waveform words are jumped over if they aren't wanted
+			int waveformMode = (waveform && !fOptions.fSkipWaveforms) ? (dualTrace ? kDualTrace : kSingleTrace) : kNoWaveform;
+			int extrasMode = kNoExtras;
+			if(extras) {
+				switch(extraFormat) {
+					case 0:  extrasMode = kExtrasFormat0; break;
+					case 1:  extrasMode = kExtrasFormat1; break;
+					case 2:  extrasMode = kExtrasFormat2; break;
+					case 7:  extrasMode = kExtrasDebugWord; break;
+					default: extrasMode = kExtrasIgnored; break;
+				}
+			}
+			(this->*EventLoops<HitsOnly, Sink>::fTable[waveformMode][extrasMode])(data + w, (numWords-2)/eventSize, numSampleWords, channel, sink); // -2 = 2 header words for channel aggregate
+			w += numWords - 2;
+		} // for(uint8_t channel = 0; channel < 16; channel += 2)
+	} // for(int board = 0; w < bankSize; ++board)
+
+	return true;
+}
+template<bool HitsOnly, typename Sink>
+const typename CaenDecoder::EventLoops<HitsOnly, Sink>::EventLoop CaenDecoder::EventLoops<HitsOnly, Sink>::fTable[CaenDecoder::kNofWaveformModes][CaenDecoder::kNofExtrasModes] = {
+	{
+		&CaenDecoder::DecodeEvents<kNoWaveform, kNoExtras, HitsOnly, Sink>,
+		&CaenDecoder::DecodeEvents<kNoWaveform, kExtrasFormat0, HitsOnly, Sink>,
+		&CaenDecoder::DecodeEvents<kNoWaveform, kExtrasFormat1, HitsOnly, Sink>,
+		&CaenDecoder::DecodeEvents<kNoWaveform, kExtrasFormat2, HitsOnly, Sink>,
+		&CaenDecoder::DecodeEvents<kNoWaveform, kExtrasDebugWord, HitsOnly, Sink>,
+		&CaenDecoder::DecodeEvents<kNoWaveform, kExtrasIgnored, HitsOnly, Sink>
+	}, {
+		&CaenDecoder::DecodeEvents<kSingleTrace, kNoExtras, HitsOnly, Sink>,
+		&CaenDecoder::DecodeEvents<kSingleTrace, kExtrasFormat0, HitsOnly, Sink>,
+		&CaenDecoder::DecodeEvents<kSingleTrace, kExtrasFormat1, HitsOnly, Sink>,
+		&CaenDecoder::DecodeEvents<kSingleTrace, kExtrasFormat2, HitsOnly, Sink>,
+		&CaenDecoder::DecodeEvents<kSingleTrace, kExtrasDebugWord, HitsOnly, Sink>,
+		&CaenDecoder::DecodeEvents<kSingleTrace, kExtrasIgnored, HitsOnly, Sink>
+	}, {
+		&CaenDecoder::DecodeEvents<kDualTrace, kNoExtras, HitsOnly, Sink>,
+		&CaenDecoder::DecodeEvents<kDualTrace, kExtrasFormat0, HitsOnly, Sink>,
+		&CaenDecoder::DecodeEvents<kDualTrace, kExtrasFormat1, HitsOnly, Sink>,
+		&CaenDecoder::DecodeEvents<kDualTrace, kExtrasFormat2, HitsOnly, Sink>,
+		&CaenDecoder::DecodeEvents<kDualTrace, kExtrasDebugWord, HitsOnly, Sink>,
+		&CaenDecoder::DecodeEvents<kDualTrace, kExtrasIgnored, HitsOnly, Sink>
+	}
+};
+
+template<int WaveformMode, int ExtrasMode, bool HitsOnly, typename Sink>
+void CaenDecoder::DecodeEvents(const uint32_t* data, int nofEvents, int numSampleWords, uint8_t channel, Sink& sink)
+{
+	// all conditions on WaveformMode, ExtrasMode, and HitsOnly are resolved at compile time
+	// numSampleWords is also set if the waveforms are skipped (kNoWaveform), so the stride is always right
+	const int eventSize = numSampleWords + (ExtrasMode == kNoExtras ? 2 : 3); // +2 = trigger time word and charge word
+	for(int ev = 0; ev < nofEvents; ++ev, data += eventSize) {
+		// the quantities are always decoded into the compact hit first
+		fHit.fChannel = channel + (data[0]>>31); // highest bit indicates odd channel
+		if(((fOptions.fChannelMask>>fHit.fChannel) & 0x1) == 0x0) {
+			continue;
+		}
+		fHit.fTimestamp = (static_cast<uint64_t>(fBoardId)<<CaenHit::kBoardShift) | (data[0] & 0x7fffffff);
+		fHit.fCfd = 0;
+		fHit.fFlags = 0;
+		const uint32_t* word = data + 1 + numSampleWords;
+		if(ExtrasMode == kExtrasFormat0) {
+			// [31:16] extended time stamp, [15:0] baseline*4
+			fHit.fTimestamp |= static_cast<uint64_t>(*word>>16)<<31;
+		} else if(ExtrasMode == kExtrasFormat1 || ExtrasMode == kExtrasFormat2) {
+			// [31:16] extended time stamp, 15 trigger lost, 14 over range, 13 1024 triggers, 12 n lost triggers, format 2 also has [9:0] fine time stamp
+			if(ExtrasMode == kExtrasFormat2) {
+				fHit.fCfd = *word&0x3ff;
+			}
+			fHit.SetFlag(CaenHit::kNLostCount, ((*word>>12)&0x1) == 0x1);
+			fHit.SetFlag(CaenHit::kKiloCount, ((*word>>13)&0x1) == 0x1);
+			// the over range bit is also part of the charge word, which is the one that's used
+			fHit.SetFlag(CaenHit::kLostTrigger, ((*word>>15)&0x1) == 0x1);
+			fHit.fTimestamp |= static_cast<uint64_t>(*word>>16)<<31;
+		} else if(ExtrasMode == kExtrasDebugWord) {
+			// fixed value of 0x12345678
+			if(*word != 0x12345678) {
+				std::cerr<<"Failed to get debug data word 0x12345678, got "<<std::hex<<std::setw(8)<<std::setfill('0')<<*word<<std::dec<<std::setfill(' ')<<std::endl;
+			}
+		}
+		// format 4 ([31:16] lost trigger counter, [15:0] total trigger counter) and
+		// format 5 ([31:16] CFD sample after zero cross., [15:0] CFD sample before zero cross.) are not stored
+		if(ExtrasMode != kNoExtras) ++word;
+		fHit.fShortGate = *word&0x7fff;
+		fHit.SetFlag(CaenHit::kOverRange, ((*word>>15) & 0x1) == 0x1);
+		fHit.fCharge = *word>>16;
+		Emit<WaveformMode>(data + 1, numSampleWords, sink, std::integral_constant<bool, HitsOnly>());
+	}
+}
+
+template<int WaveformMode, typename Sink>
+void CaenDecoder::Emit(const uint32_t*, int, Sink& sink, std::true_type)
+{
+	sink(static_cast<const CaenHit&>(fHit));
+}
+
+template<int WaveformMode, typename Sink>
+void CaenDecoder::Emit(const uint32_t* samples, int numSampleWords, Sink& sink, std::false_type)
+{
+	fEvent.Clear();
+	fEvent.Set(fHit);
+	if(WaveformMode != kNoWaveform) {
+		// each word has two samples, in dual trace mode they're one sample each of the two traces
+		uint16_t* trace0 = (WaveformMode == kDualTrace) ? fEvent.ResizeWaveforms(2, numSampleWords) : fEvent.ResizeWaveforms(1, 2*numSampleWords);
+		uint16_t* trace1 = (WaveformMode == kDualTrace) ? trace0 + numSampleWords : nullptr;
+		uint8_t* digital0 = nullptr;
+		uint8_t* digital1 = nullptr;
+		if(!fOptions.fSkipDigitalProbes) {
+			digital0 = fEvent.ResizeDigitalWaveforms(2, 2*numSampleWords);
+			digital1 = digital0 + 2*numSampleWords;
+		}
+		CaenUnpack::Unpack(samples, numSampleWords, WaveformMode == kDualTrace, trace0, trace1, digital0, digital1);
+	}
+	if(fDebug > 5) {
+		fEvent.Print();
+	}
+	sink(static_cast<const CaenEvent&>(fEvent));
+}
+#endif
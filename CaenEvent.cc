@@ -1,6 +1,7 @@
 #include "CaenEvent.hh"
 
 #include <iostream>
+#include <stdexcept>
 
 ClassImp(CaenEvent)
 
@@ -16,6 +17,7 @@ CaenEvent::CaenEvent(int channel, const CAEN_DGTZ_DPP_PSD_Event_t& event, const
 
 void CaenEvent::Read(int channel, const CAEN_DGTZ_DPP_PSD_Event_t& event, const CAEN_DGTZ_DPP_PSD_Waveforms_t* waveforms)
 {
+	fBoard = 0;
 	fChannel = channel;
 	fTriggerTime = event.TimeTag;
 	fCharge = event.ChargeLong;
@@ -30,18 +32,54 @@ void CaenEvent::Read(int channel, const CAEN_DGTZ_DPP_PSD_Event_t& event, const
 	fFormat2 = event.Format2;
 	fBaseline = event.Baseline;
 	fPur = event.Pur;
-	fWaveforms.resize(2);
-	fDigitalWaveforms.resize(2);
 	if(waveforms != nullptr) {
-		fWaveforms[0].assign(waveforms->Trace1, waveforms->Trace1 + waveforms->Ns);
-		fWaveforms[1].assign(waveforms->Trace2, waveforms->Trace2 + waveforms->Ns);
-		fDigitalWaveforms[0].assign(waveforms->DTrace1, waveforms->DTrace1 + waveforms->Ns);
-		fDigitalWaveforms[1].assign(waveforms->DTrace2, waveforms->DTrace2 + waveforms->Ns);
+		uint16_t* samples = ResizeWaveforms(2, waveforms->Ns);
+		std::copy(waveforms->Trace1, waveforms->Trace1 + waveforms->Ns, samples);
+		std::copy(waveforms->Trace2, waveforms->Trace2 + waveforms->Ns, samples + waveforms->Ns);
+		uint8_t* digitalSamples = ResizeDigitalWaveforms(2, waveforms->Ns);
+		std::copy(waveforms->DTrace1, waveforms->DTrace1 + waveforms->Ns, digitalSamples);
+		std::copy(waveforms->DTrace2, waveforms->DTrace2 + waveforms->Ns, digitalSamples + waveforms->Ns);
+	} else {
+		ResizeWaveforms(0, 0);
+		ResizeDigitalWaveforms(0, 0);
 	}
 }
 
+void CaenEvent::Set(const CaenHit& hit)
+{
+	fBoard = hit.Board();
+	fChannel = hit.fChannel;
+	fTriggerTime = hit.TriggerTime();
+	fCharge = hit.fCharge;
+	fExtendedTimestamp = hit.ExtendedTimestamp();
+	fCfd = hit.fCfd;
+	fLostTrigger = hit.LostTrigger();
+	fOverRange = hit.OverRange();
+	fKiloCount = hit.KiloCount();
+	fNLostCount = hit.NLostCount();
+	fShortGate = hit.fShortGate;
+}
+
+CaenHit CaenEvent::Hit() const
+{
+	CaenHit hit;
+	hit.fTimestamp = GetTimestamp();
+	hit.fCfd = fCfd;
+	hit.fCharge = fCharge;
+	hit.fShortGate = fShortGate;
+	hit.fChannel = fChannel;
+	hit.SetBoard(fBoard);
+	hit.fFlags = 0;
+	hit.SetFlag(CaenHit::kLostTrigger, fLostTrigger);
+	hit.SetFlag(CaenHit::kOverRange, fOverRange);
+	hit.SetFlag(CaenHit::kKiloCount, fKiloCount);
+	hit.SetFlag(CaenHit::kNLostCount, fNLostCount);
+	return hit;
+}
+
 void CaenEvent::Clear()
 {
+	fBoard = 0;
 	fChannel = -1;
 	fTriggerTime = 0;
 	fCharge = 0;
@@ -56,24 +94,107 @@ void CaenEvent::Clear()
 	fFormat2 = 0;
 	fBaseline = 0;
 	fPur = 0;
-	fWaveforms.clear();
-	fDigitalWaveforms.clear();
+	// clear keeps the memory of the vectors, so a re-used event doesn't need to allocate them again
+	fSamples.clear();
+	fDigitalSamples.clear();
+	fNofWaveforms = 0;
+	fNofDigitalWaveforms = 0;
+	fWaveformOffset[0] = 0;
+	fDigitalWaveformOffset[0] = 0;
+}
+
+// the analog and digital traces are handled the same way, just with different sample types
+namespace {
+	template<typename T>
+	void AddSample(std::vector<T>& samples, uint8_t& nofTraces, uint32_t* offset, size_t i, T sample)
+	{
+		if(i >= CaenEvent::kMaxTraces) {
+			throw std::out_of_range("CaenEvent: too many traces");
+		}
+		// add empty traces up to this one
+		for(; nofTraces <= i; ++nofTraces) {
+			offset[nofTraces+1] = offset[nofTraces];
+		}
+		if(i + 1 == nofTraces) {
+			samples.push_back(sample);
+		} else {
+			samples.insert(samples.begin() + offset[i+1], sample);
+		}
+		for(size_t t = i + 1; t <= nofTraces; ++t) {
+			++offset[t];
+		}
+	}
+
+	template<typename T>
+	T* Resize(std::vector<T>& samples, uint8_t& nofTraces, uint32_t* offset, size_t newNofTraces, size_t samplesPerTrace)
+	{
+		if(newNofTraces > CaenEvent::kMaxTraces) {
+			throw std::out_of_range("CaenEvent: too many traces");
+		}
+		samples.resize(newNofTraces*samplesPerTrace);
+		nofTraces = newNofTraces;
+		for(size_t t = 0; t <= nofTraces; ++t) {
+			offset[t] = t*samplesPerTrace;
+		}
+		return samples.data();
+	}
+
+	template<typename T>
+	void SetTraces(std::vector<T>& samples, uint8_t& nofTraces, uint32_t* offset, const std::vector<std::vector<T> >& traces)
+	{
+		if(traces.size() > CaenEvent::kMaxTraces) {
+			throw std::out_of_range("CaenEvent: too many traces");
+		}
+		samples.clear();
+		nofTraces = traces.size();
+		offset[0] = 0;
+		for(size_t t = 0; t < traces.size(); ++t) {
+			samples.insert(samples.end(), traces[t].begin(), traces[t].end());
+			offset[t+1] = samples.size();
+		}
+	}
 }
 
 void CaenEvent::AddWaveformSample(size_t i, uint16_t sample)
 {
-	if(i >= fWaveforms.size()) {
-		fWaveforms.resize(i+1); 
-	}
-	fWaveforms[i].push_back(sample);
+	AddSample(fSamples, fNofWaveforms, fWaveformOffset, i, sample);
 }
 
 void CaenEvent::AddDigitalWaveformSample(size_t i, uint8_t sample)
 {
-	if(i >= fDigitalWaveforms.size()) {
-		fDigitalWaveforms.resize(i+1);
+	AddSample(fDigitalSamples, fNofDigitalWaveforms, fDigitalWaveformOffset, i, sample);
+}
+
+uint16_t* CaenEvent::ResizeWaveforms(size_t nofTraces, size_t samplesPerTrace)
+{
+	return Resize(fSamples, fNofWaveforms, fWaveformOffset, nofTraces, samplesPerTrace);
+}
+
+uint8_t* CaenEvent::ResizeDigitalWaveforms(size_t nofTraces, size_t samplesPerTrace)
+{
+	return Resize(fDigitalSamples, fNofDigitalWaveforms, fDigitalWaveformOffset, nofTraces, samplesPerTrace);
+}
+
+void CaenEvent::SetWaveforms(const std::vector<std::vector<uint16_t> >& waveforms, const std::vector<std::vector<uint8_t> >& digitalWaveforms)
+{
+	SetTraces(fSamples, fNofWaveforms, fWaveformOffset, waveforms);
+	SetTraces(fDigitalSamples, fNofDigitalWaveforms, fDigitalWaveformOffset, digitalWaveforms);
+}
+
+CaenSpan<uint16_t> CaenEvent::Waveform(size_t i) const
+{
+	if(i >= fNofWaveforms) {
+		throw std::out_of_range("CaenEvent::Waveform");
+	}
+	return CaenSpan<uint16_t>(fSamples.data() + fWaveformOffset[i], fWaveformOffset[i+1] - fWaveformOffset[i]);
+}
+
+CaenSpan<uint8_t> CaenEvent::DigitalWaveform(size_t i) const
+{
+	if(i >= fNofDigitalWaveforms) {
+		throw std::out_of_range("CaenEvent::DigitalWaveform");
 	}
-	fDigitalWaveforms[i].push_back(sample);
+	return CaenSpan<uint8_t>(fDigitalSamples.data() + fDigitalWaveformOffset[i], fDigitalWaveformOffset[i+1] - fDigitalWaveformOffset[i]);
 }
 
 uint64_t CaenEvent::GetTimestamp() const {
@@ -88,9 +209,16 @@ double CaenEvent::GetTime() const
 	return GetTimestamp()*2. + (fCfd/512.);
 }
 
+uint64_t CaenEvent::GetTimePs() const
+{
+	// 2000 ps per timestamp tick, the CFD is 1/1024 of a tick (2000/1024 = 125/64)
+	return GetTimestamp()*2000 + ((fCfd*125)>>6);
+}
+
 void CaenEvent::Print(Option_t*) const
 {
 	std::cout<<"event "<<this<<std::endl;
+	std::cout<<"board "<<static_cast<int>(fBoard)<<", channel "<<fChannel<<std::endl;
 	std::cout<<"trigger time = "<<fTriggerTime<<" = 0x"<<std::hex<<fTriggerTime<<std::dec<<std::endl;
 	std::cout<<"charge = "<<fCharge<<" = 0x"<<std::hex<<fCharge<<std::dec<<std::endl;
 	std::cout<<"extended TS = "<<fExtendedTimestamp<<" = 0x"<<std::hex<<fExtendedTimestamp<<std::dec<<std::endl;
@@ -104,10 +232,10 @@ void CaenEvent::Print(Option_t*) const
 	std::cout<<"format2 = "<<fFormat2<<" = 0x"<<std::hex<<fFormat2<<std::dec<<std::endl;
 	std::cout<<"baseline = "<<fBaseline<<" = 0x"<<std::hex<<fBaseline<<std::dec<<std::endl;
 	std::cout<<"pur = "<<fPur<<" = 0x"<<std::hex<<fPur<<std::dec<<std::endl;
-	for(size_t i = 0; i < fWaveforms.size(); ++i) {
-		std::cout<<i<<". waveform with "<<fWaveforms[i].size()<<" samples"<<std::endl;
+	for(size_t i = 0; i < fNofWaveforms; ++i) {
+		std::cout<<i<<". waveform with "<<fWaveformOffset[i+1] - fWaveformOffset[i]<<" samples"<<std::endl;
 	}
-	for(size_t i = 0; i < fDigitalWaveforms.size(); ++i) {
-		std::cout<<i<<". digital waveform with "<<fDigitalWaveforms[i].size()<<" samples"<<std::endl;
+	for(size_t i = 0; i < fNofDigitalWaveforms; ++i) {
+		std::cout<<i<<". digital waveform with "<<fDigitalWaveformOffset[i+1] - fDigitalWaveformOffset[i]<<" samples"<<std::endl;
 	}
 }
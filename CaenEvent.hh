@@ -1,12 +1,21 @@
 #ifndef CAENEVENT_HH
 #define CAENEVENT_HH
 
+#include <vector>
+
 #include "TObject.h"
 
 #include "CAENDigitizer.h"
 
+#include "CaenHit.hh"
+#include "CaenSpan.hh"
+
+// all analog traces of an event are stored after each other in one vector, and so are all digital traces,
+// the offsets say where each trace starts, so the memory is kept when the event is cleared and re-used
 class CaenEvent : public TObject {
 public:
+	static const size_t kMaxTraces = 4; // maximum number of analog and of digital traces
+
 	CaenEvent();
 	CaenEvent(int channel, const CAEN_DGTZ_DPP_PSD_Event_t& event, const CAEN_DGTZ_DPP_PSD_Waveforms_t* waveforms);
 	~CaenEvent() {}
@@ -15,6 +24,11 @@ public:
 	void Read(int channel, const CAEN_DGTZ_DPP_PSD_Event_t& event, const CAEN_DGTZ_DPP_PSD_Waveforms_t* waveforms);
 	void Print(Option_t* opt = NULL) const;
 
+	// sets all quantities except for the waveforms from a compact hit, and vice versa
+	void Set(const CaenHit& hit);
+	CaenHit Hit() const;
+
+	void Board(uint8_t value) { fBoard = value; }
 	void Channel(int value) { fChannel = value; }
 	void TriggerTime(uint32_t value) { fTriggerTime = value; }
 	void Charge(uint16_t value) { fCharge = value; }
@@ -27,7 +41,15 @@ public:
 	void ShortGate(uint16_t value) { fShortGate = value; }
 	void AddWaveformSample(size_t i, uint16_t sample);
 	void AddDigitalWaveformSample(size_t i, uint8_t sample);
+	// set nofTraces (digital) waveforms of samplesPerTrace each and return the start of the first one, so they can be filled in bulk
+	// (trace i starts at i*samplesPerTrace)
+	uint16_t* ResizeWaveforms(size_t nofTraces, size_t samplesPerTrace);
+	uint8_t*  ResizeDigitalWaveforms(size_t nofTraces, size_t samplesPerTrace);
+	// copies the (digital) waveforms from one vector per trace
+	void SetWaveforms(const std::vector<std::vector<uint16_t> >& waveforms, const std::vector<std::vector<uint8_t> >& digitalWaveforms);
 
+	// board ID (GEO address from the board aggregate header)
+	int Board() const { return fBoard; }
 	int Channel() const { return fChannel; }
 	uint32_t TriggerTime() const { return fTriggerTime; }
 	uint16_t Charge() const { return fCharge; }
@@ -38,15 +60,25 @@ public:
 	bool KiloCount() const { return fKiloCount; }
 	bool NLostCount() const { return fNLostCount; }
 	uint16_t ShortGate() const { return fShortGate; }
-	std::vector<uint16_t> Waveform(size_t i) const { return fWaveforms.at(i); }
-	std::vector<uint8_t>  DigitalWaveform(size_t i) const { return fDigitalWaveforms.at(i); }
+	size_t NofWaveforms() const { return fNofWaveforms; }
+	size_t NofDigitalWaveforms() const { return fNofDigitalWaveforms; }
+	// views of the i-th (digital) waveform without copying it, only valid until the event is changed
+	// (convert to a std::vector to keep a copy), throw std::out_of_range if there is no such waveform
+	CaenSpan<uint16_t> Waveform(size_t i) const;
+	CaenSpan<uint8_t>  DigitalWaveform(size_t i) const;
+	// all samples of all analog/digital traces
+	const std::vector<uint16_t>& Samples() const { return fSamples; }
+	const std::vector<uint8_t>&  DigitalSamples() const { return fDigitalSamples; }
 
 	uint64_t GetTimestamp() const;
 	double GetTime() const;
+	// time in ps as integer, keeps the full CFD precision (to ~2 ps) for any timestamp
+	uint64_t GetTimePs() const;
 
 	bool CheckTime() const { return (fExtendedTimestamp != 0 || fTriggerTime != 0 || fCfd != 0); }
 
 private:
+	uint8_t fBoard;
 	int fChannel;
 	uint32_t fTriggerTime;
 	uint16_t fCharge;
@@ -61,9 +93,13 @@ private:
 	uint32_t fFormat2;
 	uint16_t fBaseline;
 	uint16_t fPur;
-	std::vector<std::vector<uint16_t> > fWaveforms;
-	std::vector<std::vector<uint8_t> >  fDigitalWaveforms;
+	std::vector<uint16_t> fSamples;
+	std::vector<uint8_t>  fDigitalSamples;
+	uint8_t  fNofWaveforms;
+	uint8_t  fNofDigitalWaveforms;
+	uint32_t fWaveformOffset[kMaxTraces+1];        // trace i is [fWaveformOffset[i], fWaveformOffset[i+1]) of fSamples
+	uint32_t fDigitalWaveformOffset[kMaxTraces+1]; // same for fDigitalSamples
 
-	ClassDef(CaenEvent, 2)
+	ClassDef(CaenEvent, 4)
 };
 #endif
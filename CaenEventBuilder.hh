@@ -0,0 +1,79 @@
+#ifndef CAENEVENTBUILDER_HH
+#define CAENEVENTBUILDER_HH
+#include <vector>
+#include <cstddef>
+#include <cstdint>
+
+#include "CaenHit.hh"
+
+// groups time-ordered hits (e.g. from CaenTimeSorter) into built events
+// the times are integers in ps, either GetTimePs() of the hits or the unwrapped times from CaenTimestampUnwrapper
+// an event is opened by the first hit and gets all following hits within the coincidence window of it,
+// the first hit outside the window closes it and opens the next one
+// a closed event is passed on if it has at least the minimum multiplicity and (if a trigger channel is set) a hit in the trigger channel
+class CaenEventBuilder {
+public:
+	// window in ns, triggerChannel < 0 means any channel
+	CaenEventBuilder(double window, int triggerChannel = -1, size_t minMultiplicity = 1)
+		: fWindow(static_cast<uint64_t>(window*1000.)), fTriggerChannel(triggerChannel), fMinMultiplicity(minMultiplicity), fStart(0), fNofBuilt(0), fNofRejected(0) {}
+
+	// adds the next hit, and calls sink(const std::vector<CaenHit>&) if that closes an accepted event
+	template<typename Sink>
+	void Add(const CaenHit& hit, Sink&& sink) {
+		Add(hit, hit.GetTimePs(), sink);
+	}
+
+	// same with the time in ps given explicitly, a late hit from before the start of the open event closes it as well
+	template<typename Sink>
+	void Add(const CaenHit& hit, uint64_t time, Sink&& sink) {
+		if(!fHits.empty() && (time < fStart || time - fStart > fWindow)) {
+			Close(sink);
+		}
+		if(fHits.empty()) {
+			fStart = time;
+		}
+		fHits.push_back(hit);
+	}
+
+	// closes the last event, e.g. at the end of the run
+	template<typename Sink>
+	void Flush(Sink&& sink) {
+		if(!fHits.empty()) {
+			Close(sink);
+		}
+	}
+
+	uint64_t NofBuilt() const { return fNofBuilt; }
+	uint64_t NofRejected() const { return fNofRejected; }
+
+private:
+	template<typename Sink>
+	void Close(Sink& sink) {
+		if(Accept()) {
+			sink(static_cast<const std::vector<CaenHit>&>(fHits));
+			++fNofBuilt;
+		} else {
+			++fNofRejected;
+		}
+		fHits.clear();
+	}
+
+	bool Accept() const {
+		if(fHits.size() < fMinMultiplicity) return false;
+		if(fTriggerChannel < 0) return true;
+		for(const auto& hit : fHits) {
+			if(hit.Channel() == fTriggerChannel) return true;
+		}
+		return false;
+	}
+
+	uint64_t fWindow; // in ps
+	int fTriggerChannel;
+	size_t fMinMultiplicity;
+
+	std::vector<CaenHit> fHits; // hits of the open event
+	uint64_t fStart;            // time of the first hit of the open event
+	uint64_t fNofBuilt;
+	uint64_t fNofRejected;
+};
+#endif
@@ -0,0 +1,103 @@
+#include "CaenFlatTree.hh"
+
+#include <algorithm>
+
+// clusters of ~32 MB, each scalar column gets a basket that holds a whole cluster of it,
+// so reading a few columns means a few large reads instead of many small ones
+static const Long64_t gFlatClusterBytes = 32*1024*1024;
+static const int gScalarBasketSize = 256*1024;
+static const int gWaveformBasketSize = 4*1024*1024;
+
+CaenFlatTree::CaenFlatTree(TTree* tree, bool waveforms)
+	: fTree(tree), fWaveforms(waveforms), fChannel(0), fTimestamp(0), fCfd(0), fCharge(0), fShortGate(0), fFlags(0),
+	  fNofSamples(0), fSamples(1), fSamplesAddress(fSamples.data()),
+	  fNofTraces(0), fTraceOffsets(2), fTraceOffsetsAddress(fTraceOffsets.data()),
+	  fNofDigitalSamples(0), fDigital(1), fDigitalAddress(fDigital.data())
+{
+	fTree->SetAutoFlush(-gFlatClusterBytes);
+	fTree->Branch("channel", &fChannel, "channel/b", gScalarBasketSize);
+	fTree->Branch("timestamp", &fTimestamp, "timestamp/l", gScalarBasketSize);
+	fTree->Branch("cfd", &fCfd, "cfd/s", gScalarBasketSize);
+	fTree->Branch("charge", &fCharge, "charge/s", gScalarBasketSize);
+	fTree->Branch("shortGate", &fShortGate, "shortGate/s", gScalarBasketSize);
+	fTree->Branch("flags", &fFlags, "flags/b", gScalarBasketSize);
+	if(!fWaveforms) {
+		fSamplesBranch = nullptr;
+		fTraceOffsetsBranch = nullptr;
+		fDigitalBranch = nullptr;
+		return;
+	}
+
+	fTree->Branch("nofSamples", &fNofSamples, "nofSamples/i", gScalarBasketSize);
+	fSamplesBranch = fTree->Branch("samples", fSamplesAddress, "samples[nofSamples]/s", gWaveformBasketSize);
+	fTree->Branch("nofTraces", &fNofTraces, "nofTraces/i", gScalarBasketSize);
+	fTraceOffsetsBranch = fTree->Branch("traceOffsets", fTraceOffsetsAddress, "traceOffsets[nofTraces]/i", gScalarBasketSize);
+	fTree->Branch("nofDigitalSamples", &fNofDigitalSamples, "nofDigitalSamples/i", gScalarBasketSize);
+	fDigitalBranch = fTree->Branch("digital", fDigitalAddress, "digital[nofDigitalSamples]/b", gWaveformBasketSize);
+}
+
+void CaenFlatTree::SetHit(const CaenHit& hit)
+{
+	fChannel   = hit.fChannel;
+	fTimestamp = hit.GetTimestamp();
+	fCfd       = hit.fCfd;
+	fCharge    = hit.fCharge;
+	fShortGate = hit.fShortGate;
+	fFlags     = hit.fFlags;
+}
+
+void CaenFlatTree::Fill(const CaenHit& hit)
+{
+	SetHit(hit);
+	fNofSamples = 0;
+	fNofTraces = 0;
+	fNofDigitalSamples = 0;
+	fTree->Fill();
+}
+
+void CaenFlatTree::Fill(const CaenEvent& event)
+{
+	SetHit(event.Hit());
+	if(!fWaveforms) {
+		fTree->Fill();
+		return;
+	}
+
+	// analog traces after each other, plus where each of them starts
+	fNofSamples = 0;
+	fNofTraces = event.NofWaveforms();
+	if(fTraceOffsets.size() < fNofTraces) {
+		fTraceOffsets.resize(fNofTraces);
+	}
+	for(uint32_t i = 0; i < fNofTraces; ++i) {
+		auto waveform = event.Waveform(i);
+		fTraceOffsets[i] = fNofSamples;
+		fNofSamples += waveform.size();
+		if(fSamples.size() < fNofSamples) {
+			fSamples.resize(fNofSamples);
+		}
+		std::copy(waveform.begin(), waveform.end(), fSamples.begin() + fTraceOffsets[i]);
+	}
+
+	// both digital probes in one byte per sample
+	fNofDigitalSamples = 0;
+	size_t nofDigitalWaveforms = std::min(event.NofDigitalWaveforms(), static_cast<size_t>(2));
+	for(size_t i = 0; i < nofDigitalWaveforms; ++i) {
+		fNofDigitalSamples = std::max(fNofDigitalSamples, static_cast<uint32_t>(event.DigitalWaveform(i).size()));
+	}
+	if(fDigital.size() < fNofDigitalSamples) {
+		fDigital.resize(fNofDigitalSamples);
+	}
+	std::fill(fDigital.begin(), fDigital.begin() + fNofDigitalSamples, 0);
+	for(size_t i = 0; i < nofDigitalWaveforms; ++i) {
+		auto waveform = event.DigitalWaveform(i);
+		for(size_t s = 0; s < waveform.size(); ++s) {
+			fDigital[s] |= (waveform[s]&0x1)<<i;
+		}
+	}
+
+	UpdateAddress(fSamplesBranch, fSamples, fSamplesAddress);
+	UpdateAddress(fTraceOffsetsBranch, fTraceOffsets, fTraceOffsetsAddress);
+	UpdateAddress(fDigitalBranch, fDigital, fDigitalAddress);
+	fTree->Fill();
+}
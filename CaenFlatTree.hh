@@ -0,0 +1,64 @@
+#ifndef CAENFLATTREE_HH
+#define CAENFLATTREE_HH
+#include <vector>
+#include <cstdint>
+
+#include "TTree.h"
+
+#include "CaenEvent.hh"
+#include "CaenHit.hh"
+
+// writes hits as flat columns instead of CaenEvent objects, so reading e.g. only charge and time
+// doesn't need the CaenEvent dictionary and only reads the baskets of these branches
+// branches:
+// channel/b, timestamp/l (extended timestamp and trigger time combined), cfd/s, charge/s, shortGate/s,
+// flags/b (CaenHit::EFlags: bit 0 lost trigger, bit 1 over range, bit 2 1024 triggers, bit 3 n lost triggers)
+// and unless the tree is created without waveforms:
+// nofSamples/i, samples[nofSamples]/s: all analog traces of the hit after each other
+// nofTraces/i, traceOffsets[nofTraces]/i: index of the first sample of each trace in samples
+// nofDigitalSamples/i, digital[nofDigitalSamples]/b: bit 0 digital probe 1, bit 1 digital probe 2
+class CaenFlatTree {
+public:
+	CaenFlatTree(TTree* tree, bool waveforms = true);
+	~CaenFlatTree() {}
+
+	void Fill(const CaenEvent& event);
+	// compact hits have no waveforms, so the waveform branches (if there are any) get empty entries
+	void Fill(const CaenHit& hit);
+
+private:
+	// sets the branch address again if a vector had to grow
+	void SetHit(const CaenHit& hit);
+
+	template<typename T>
+	void UpdateAddress(TBranch* branch, std::vector<T>& values, T*& address) {
+		if(values.data() != address) {
+			address = values.data();
+			branch->SetAddress(address);
+		}
+	}
+
+	TTree* fTree;
+	bool fWaveforms;
+
+	uint8_t  fChannel;
+	uint64_t fTimestamp;
+	uint16_t fCfd;
+	uint16_t fCharge;
+	uint16_t fShortGate;
+	uint8_t  fFlags;
+
+	uint32_t fNofSamples;
+	std::vector<uint16_t> fSamples;
+	uint16_t* fSamplesAddress;
+	TBranch* fSamplesBranch;
+	uint32_t fNofTraces;
+	std::vector<uint32_t> fTraceOffsets;
+	uint32_t* fTraceOffsetsAddress;
+	TBranch* fTraceOffsetsBranch;
+	uint32_t fNofDigitalSamples;
+	std::vector<uint8_t> fDigital;
+	uint8_t* fDigitalAddress;
+	TBranch* fDigitalBranch;
+};
+#endif
@@ -0,0 +1,52 @@
+#include "CaenHistogram.hh"
+
+#include <algorithm>
+#include <stdexcept>
+
+CaenHistogram1D::CaenHistogram1D(const std::string& name, const std::string& title, int nofBins, double low, double high)
+	: fName(name), fTitle(title), fNofBins(nofBins), fLow(low), fHigh(high), fScale(nofBins/(high - low)), fCounts(nofBins + 2, 0), fEntries(0)
+{
+}
+
+void CaenHistogram1D::Add(const CaenHistogram1D& other)
+{
+	if(other.fNofBins != fNofBins || other.fLow != fLow || other.fHigh != fHigh) {
+		throw std::invalid_argument("CaenHistogram1D::Add: can't add "+other.fName+" to "+fName+", the binning is different");
+	}
+	for(size_t i = 0; i < fCounts.size(); ++i) {
+		fCounts[i] += other.fCounts[i];
+	}
+	fEntries += other.fEntries;
+}
+
+void CaenHistogram1D::Reset()
+{
+	std::fill(fCounts.begin(), fCounts.end(), 0);
+	fEntries = 0;
+}
+
+CaenHistogram2D::CaenHistogram2D(const std::string& name, const std::string& title, int nofXBins, double xLow, double xHigh, int nofYBins, double yLow, double yHigh)
+	: fName(name), fTitle(title),
+	  fNofXBins(nofXBins), fXLow(xLow), fXHigh(xHigh), fXScale(nofXBins/(xHigh - xLow)),
+	  fNofYBins(nofYBins), fYLow(yLow), fYHigh(yHigh), fYScale(nofYBins/(yHigh - yLow)),
+	  fCounts((nofXBins + 2)*(nofYBins + 2), 0), fEntries(0)
+{
+}
+
+void CaenHistogram2D::Add(const CaenHistogram2D& other)
+{
+	if(other.fNofXBins != fNofXBins || other.fXLow != fXLow || other.fXHigh != fXHigh ||
+	   other.fNofYBins != fNofYBins || other.fYLow != fYLow || other.fYHigh != fYHigh) {
+		throw std::invalid_argument("CaenHistogram2D::Add: can't add "+other.fName+" to "+fName+", the binning is different");
+	}
+	for(size_t i = 0; i < fCounts.size(); ++i) {
+		fCounts[i] += other.fCounts[i];
+	}
+	fEntries += other.fEntries;
+}
+
+void CaenHistogram2D::Reset()
+{
+	std::fill(fCounts.begin(), fCounts.end(), 0);
+	fEntries = 0;
+}
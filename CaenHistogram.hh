@@ -0,0 +1,126 @@
+#ifndef CAENHISTOGRAM_HH
+#define CAENHISTOGRAM_HH
+#include <vector>
+#include <string>
+#include <cstddef>
+#include <cstdint>
+
+#include "TH1.h"
+#include "TH2.h"
+
+#include "CaenSpan.hh"
+
+// fixed binning histograms with integer bin contents, meant to be filled in batches by one thread each,
+// and merged and converted to ROOT histograms only when they are written
+// the bins are laid out like in ROOT: bin 0 is the underflow, bin nofBins+1 the overflow (in 2D for each axis)
+// the contents are signed, so hits can be removed again by filling them with a weight of -1
+class CaenHistogram1D {
+public:
+	CaenHistogram1D(const std::string& name, const std::string& title, int nofBins, double low, double high);
+
+	void Fill(double x, int64_t weight = 1) { fCounts[Bin(x)] += weight; fEntries += weight; }
+	// fills value(hit) for all hits
+	template<typename Hit, typename Value>
+	void Fill(CaenSpan<Hit> hits, Value value, int64_t weight = 1) {
+		for(const auto& hit : hits) {
+			fCounts[Bin(value(hit))] += weight;
+		}
+		fEntries += weight*static_cast<int64_t>(hits.size());
+	}
+
+	// adds the contents of another histogram with the same binning
+	void Add(const CaenHistogram1D& other);
+	void Reset();
+
+	int64_t BinContent(int bin) const { return fCounts[bin]; }
+	int64_t Entries() const { return fEntries; }
+
+	// new ROOT histogram with the same name, title, binning, and contents
+	// double bin contents by default, so counts up to 2^53 are exact (floats would only be exact up to 2^24)
+	TH1D* CreateRootHistogram() const { return CreateRootHistogram<TH1D>(); }
+	// same with another type of ROOT histogram, e.g. TH1F where existing code expects it
+	template<typename RootHistogram>
+	RootHistogram* CreateRootHistogram() const {
+		auto result = new RootHistogram(fName.c_str(), fTitle.c_str(), fNofBins, fLow, fHigh);
+		for(int bin = 0; bin < fNofBins + 2; ++bin) {
+			result->SetBinContent(bin, fCounts[bin]);
+		}
+		result->SetEntries(fEntries);
+		return result;
+	}
+
+private:
+	int Bin(double x) const {
+		if(x < fLow) return 0;
+		if(x >= fHigh) return fNofBins + 1;
+		int bin = static_cast<int>((x - fLow)*fScale);
+		return 1 + (bin < fNofBins ? bin : fNofBins - 1); // rounding can push values just below high into the last bin + 1
+	}
+
+	std::string fName;
+	std::string fTitle;
+	int fNofBins;
+	double fLow;
+	double fHigh;
+	double fScale; // bins per unit
+	std::vector<int64_t> fCounts;
+	int64_t fEntries;
+};
+
+class CaenHistogram2D {
+public:
+	CaenHistogram2D(const std::string& name, const std::string& title, int nofXBins, double xLow, double xHigh, int nofYBins, double yLow, double yHigh);
+
+	void Fill(double x, double y, int64_t weight = 1) { fCounts[Bin(x, y)] += weight; fEntries += weight; }
+	// fills xValue(hit), yValue(hit) for all hits
+	template<typename Hit, typename XValue, typename YValue>
+	void Fill(CaenSpan<Hit> hits, XValue xValue, YValue yValue, int64_t weight = 1) {
+		for(const auto& hit : hits) {
+			fCounts[Bin(xValue(hit), yValue(hit))] += weight;
+		}
+		fEntries += weight*static_cast<int64_t>(hits.size());
+	}
+
+	void Add(const CaenHistogram2D& other);
+	void Reset();
+
+	int64_t BinContent(int xBin, int yBin) const { return fCounts[xBin + (fNofXBins + 2)*yBin]; }
+	int64_t Entries() const { return fEntries; }
+
+	TH2D* CreateRootHistogram() const { return CreateRootHistogram<TH2D>(); }
+	template<typename RootHistogram>
+	RootHistogram* CreateRootHistogram() const {
+		auto result = new RootHistogram(fName.c_str(), fTitle.c_str(), fNofXBins, fXLow, fXHigh, fNofYBins, fYLow, fYHigh);
+		// same global bin numbering as ROOT
+		for(int bin = 0; bin < static_cast<int>(fCounts.size()); ++bin) {
+			result->SetBinContent(bin, fCounts[bin]);
+		}
+		result->SetEntries(fEntries);
+		return result;
+	}
+
+private:
+	static int AxisBin(double value, int nofBins, double low, double high, double scale) {
+		if(value < low) return 0;
+		if(value >= high) return nofBins + 1;
+		int bin = static_cast<int>((value - low)*scale);
+		return 1 + (bin < nofBins ? bin : nofBins - 1);
+	}
+	int Bin(double x, double y) const {
+		return AxisBin(x, fNofXBins, fXLow, fXHigh, fXScale) + (fNofXBins + 2)*AxisBin(y, fNofYBins, fYLow, fYHigh, fYScale);
+	}
+
+	std::string fName;
+	std::string fTitle;
+	int fNofXBins;
+	double fXLow;
+	double fXHigh;
+	double fXScale;
+	int fNofYBins;
+	double fYLow;
+	double fYHigh;
+	double fYScale;
+	std::vector<int64_t> fCounts;
+	int64_t fEntries;
+};
+#endif
@@ -0,0 +1,49 @@
+#ifndef CAENHIT_HH
+#define CAENHIT_HH
+#include <cstdint>
+#include <type_traits>
+
+// compact record of a hit without waveforms (list mode), trivially copyable so it can be stored in plain arrays,
+// copied with memcpy, and sorted cheaply; CaenEvent is only needed for hits with waveforms
+// the getters have the same names as the ones of CaenEvent, so templated code can use either
+struct CaenHit {
+	uint64_t fTimestamp; // extended timestamp (16 bit) and trigger time (31 bit) combined, the board ID is stored above them
+	uint16_t fCfd;       // fine time stamp (10 bit)
+	uint16_t fCharge;    // long gate
+	uint16_t fShortGate; // short gate (15 bit)
+	uint8_t  fChannel;
+	uint8_t  fFlags;
+
+	enum EFlags : uint8_t { kLostTrigger = 0x1, kOverRange = 0x2, kKiloCount = 0x4, kNLostCount = 0x8 };
+	// the timestamp uses the lower 47 bits of fTimestamp, the board ID (GEO address from the board aggregate header) bits 48-55
+	enum : uint64_t { kTimestampMask = (UINT64_C(1)<<47) - 1 };
+	enum : int { kBoardShift = 48 };
+
+	int Board() const { return (fTimestamp>>kBoardShift) & 0xff; }
+	int Channel() const { return fChannel; }
+	uint32_t TriggerTime() const { return fTimestamp & 0x7fffffff; }
+	uint16_t ExtendedTimestamp() const { return GetTimestamp()>>31; }
+	uint16_t Cfd() const { return fCfd; }
+	uint16_t Charge() const { return fCharge; }
+	uint16_t ShortGate() const { return fShortGate; }
+	bool LostTrigger() const { return (fFlags & kLostTrigger) != 0; }
+	bool OverRange() const { return (fFlags & kOverRange) != 0; }
+	bool KiloCount() const { return (fFlags & kKiloCount) != 0; }
+	bool NLostCount() const { return (fFlags & kNLostCount) != 0; }
+
+	uint64_t GetTimestamp() const { return fTimestamp & kTimestampMask; }
+	// CFD is 10 bits for 2 ns (500 MHz sampling)
+	double GetTime() const { return GetTimestamp()*2. + (fCfd/512.); }
+	// same in ps as integer, 2000 ps per tick and 2000/1024 = 125/64 ps per CFD step
+	uint64_t GetTimePs() const { return GetTimestamp()*2000 + ((fCfd*125)>>6); }
+	void SetBoard(uint8_t board) { fTimestamp = (fTimestamp & kTimestampMask) | (static_cast<uint64_t>(board)<<kBoardShift); }
+
+	void SetFlag(EFlags flag, bool value) {
+		if(value) fFlags |= flag;
+		else      fFlags &= ~flag;
+	}
+};
+
+static_assert(sizeof(CaenHit) == 16, "CaenHit is supposed to be 16 bytes");
+static_assert(std::is_trivially_copyable<CaenHit>::value, "CaenHit has to be trivially copyable");
+#endif
@@ -0,0 +1,240 @@
+#include "CaenPipeline.hh"
+
+#include <iostream>
+
+CaenPipeline::CaenPipeline(int nofWorkers, int debug)
+	: fNofWorkers(nofWorkers), fDebug(debug), fDecoder(debug), fEventOutput(nullptr), fHitOutput(nullptr), fNofBlocksRead(0), fReaderDone(false), fBoardCounter(0)
+{
+	if(fNofWorkers < 1) fNofWorkers = 1;
+	if(fNofWorkers > 1) {
+		// enough blocks to keep all workers busy while the output is waiting for the oldest block
+		fBlocks.resize(4*fNofWorkers);
+	} else {
+		fBlocks.resize(1);
+	}
+}
+
+void CaenPipeline::Run(const std::function<bool(Block&)>& reader, const std::function<void(const CaenEvent&)>& output)
+{
+	fEventOutput = &output;
+	fHitOutput = nullptr;
+	if(fNofWorkers == 1) {
+		RunSequential(reader);
+	} else {
+		RunThreads(reader);
+	}
+	fEventOutput = nullptr;
+}
+
+void CaenPipeline::Run(const std::function<bool(Block&)>& reader, const std::function<void(const CaenHit&)>& output)
+{
+	fEventOutput = nullptr;
+	fHitOutput = &output;
+	if(fNofWorkers == 1) {
+		RunSequential(reader);
+	} else {
+		RunThreads(reader);
+	}
+	fHitOutput = nullptr;
+}
+
+void CaenPipeline::RunThreads(const std::function<bool(Block&)>& reader)
+{
+	fFree.clear();
+	fRead.clear();
+	fDecoded.clear();
+	for(auto& block : fBlocks) {
+		fFree.push_back(&block);
+	}
+	fNofBlocksRead = 0;
+	fReaderDone = false;
+	fBoardCounter = 0;
+
+	std::thread readerThread(&CaenPipeline::ReaderLoop, this, std::cref(reader));
+	std::vector<std::thread> workers;
+	for(int i = 0; i < fNofWorkers; ++i) {
+		workers.emplace_back(&CaenPipeline::WorkerLoop, this, i);
+	}
+
+	// output the decoded blocks in the order they were read
+	for(uint64_t next = 0; ; ++next) {
+		Block* block = nullptr;
+		{
+			std::unique_lock<std::mutex> lock(fMutex);
+			fCondition.wait(lock, [this, next] { return fDecoded.count(next) > 0 || (fReaderDone && next == fNofBlocksRead); });
+			if(fDecoded.count(next) == 0) break;
+			block = fDecoded[next];
+			fDecoded.erase(next);
+		}
+		Output(block);
+		{
+			std::lock_guard<std::mutex> lock(fMutex);
+			fFree.push_back(block);
+		}
+		fCondition.notify_all();
+	}
+
+	readerThread.join();
+	for(auto& worker : workers) {
+		worker.join();
+	}
+}
+
+void CaenPipeline::RunSequential(const std::function<bool(Block&)>& reader)
+{
+	// a single decoder keeps the board counter across all segments, so no extra checks are needed
+	Block& block = fBlocks[0];
+	block.Clear();
+	bool batch = (fHitOutput != nullptr) ? static_cast<bool>(fHitBatchOutput) : static_cast<bool>(fEventBatchOutput);
+	while(reader(block)) {
+		for(auto& segment : block.fSegments) {
+			size_t nofHits = 0;
+			if(batch) {
+				// the hits are collected for the batch output first
+				block.fNofHits = 0;
+				DecodeSegment(fDecoder, block, segment, 0);
+				for(size_t i = 0; i < segment.fNofHits; ++i) {
+					if(fHitOutput != nullptr) {
+						(*fHitOutput)(block.fHits[i]);
+					} else {
+						*fDecoder.Event() = block.fEvents[i];
+						(*fEventOutput)(*fDecoder.Event());
+					}
+				}
+				nofHits = segment.fNofHits;
+			} else if(fHitOutput != nullptr) {
+				const auto& output = *fHitOutput;
+				fDecoder.DecodeHits(block.fData + segment.fOffset, segment.fNofWords, [&output, &nofHits](const CaenHit& hit) { output(hit); ++nofHits; });
+			} else {
+				const auto& output = *fEventOutput;
+				fDecoder.Decode(block.fData + segment.fOffset, segment.fNofWords, [&output, &nofHits](const CaenEvent& event) { output(event); ++nofHits; });
+			}
+			if(fDebug > 3) {
+				std::cout<<"got "<<nofHits<<" events from this segment"<<std::endl;
+			}
+		}
+		block.Clear();
+	}
+}
+
+void CaenPipeline::ReaderLoop(const std::function<bool(Block&)>& reader)
+{
+	while(true) {
+		Block* block = nullptr;
+		{
+			std::unique_lock<std::mutex> lock(fMutex);
+			fCondition.wait(lock, [this] { return !fFree.empty(); });
+			block = fFree.front();
+			fFree.pop_front();
+		}
+		block->Clear();
+		bool gotData = reader(*block);
+		{
+			std::lock_guard<std::mutex> lock(fMutex);
+			if(gotData) {
+				block->fSequence = fNofBlocksRead++;
+				fRead.push_back(block);
+			} else {
+				fFree.push_back(block);
+				fReaderDone = true;
+			}
+		}
+		fCondition.notify_all();
+		if(!gotData) break;
+	}
+}
+
+void CaenPipeline::DecodeSegment(CaenDecoder& decoder, Block& block, Segment& segment, int thread)
+{
+	Block* blockPtr = &block;
+	auto eventSink = [blockPtr](const CaenEvent& event) {
+		if(blockPtr->fNofHits < blockPtr->fEvents.size()) {
+			blockPtr->fEvents[blockPtr->fNofHits] = event;
+		} else {
+			blockPtr->fEvents.push_back(event);
+		}
+		++blockPtr->fNofHits;
+	};
+	auto hitSink = [blockPtr](const CaenHit& hit) {
+		if(blockPtr->fNofHits < blockPtr->fHits.size()) {
+			blockPtr->fHits[blockPtr->fNofHits] = hit;
+		} else {
+			blockPtr->fHits.push_back(hit);
+		}
+		++blockPtr->fNofHits;
+	};
+	segment.fFirstHit = block.fNofHits;
+	if(fHitOutput != nullptr) {
+		decoder.DecodeHits(block.fData + segment.fOffset, segment.fNofWords, hitSink);
+	} else {
+		decoder.Decode(block.fData + segment.fOffset, segment.fNofWords, eventSink);
+	}
+	segment.fNofHits = block.fNofHits - segment.fFirstHit;
+	BatchOutput(block, segment, thread, 1);
+}
+
+void CaenPipeline::BatchOutput(const Block& block, const Segment& segment, int thread, int weight)
+{
+	if(segment.fNofHits == 0) return;
+	if(fHitOutput != nullptr) {
+		if(fHitBatchOutput) fHitBatchOutput(thread, CaenSpan<CaenHit>(block.fHits.data() + segment.fFirstHit, segment.fNofHits), weight);
+	} else {
+		if(fEventBatchOutput) fEventBatchOutput(thread, CaenSpan<CaenEvent>(block.fEvents.data() + segment.fFirstHit, segment.fNofHits), weight);
+	}
+}
+
+void CaenPipeline::WorkerLoop(int thread)
+{
+	CaenDecoder decoder(fDebug, fDecoder.GetOptions());
+	while(true) {
+		Block* block = nullptr;
+		{
+			std::unique_lock<std::mutex> lock(fMutex);
+			fCondition.wait(lock, [this] { return !fRead.empty() || fReaderDone; });
+			if(fRead.empty()) break;
+			block = fRead.front();
+			fRead.pop_front();
+		}
+		for(auto& segment : block->fSegments) {
+			// each segment starts with a fresh board counter, the check against the previous segments is done by the output
+			decoder.ResetBoardCounter();
+			DecodeSegment(decoder, *block, segment, thread);
+			segment.fNofBoardAggregates = decoder.NofBoardAggregates();
+			segment.fFirstBoardCounter = decoder.FirstBoardCounter();
+			segment.fLastBoardCounter = decoder.BoardCounter();
+		}
+		{
+			std::lock_guard<std::mutex> lock(fMutex);
+			fDecoded[block->fSequence] = block;
+		}
+		fCondition.notify_all();
+	}
+}
+
+void CaenPipeline::Output(Block* block)
+{
+	CaenEvent* event = fDecoder.Event();
+	for(auto& segment : block->fSegments) {
+		// a single decoder would have rejected the whole segment if its first board counter is less than the last one
+		// (the board counters within the segment have already been checked by the worker)
+		if(segment.fNofBoardAggregates > 0) {
+			if(segment.fFirstBoardCounter < fBoardCounter) {
+				std::cerr<<"current board counter "<<segment.fFirstBoardCounter<<" is less than previous one "<<fBoardCounter<<", skipping this data"<<std::endl;
+				BatchOutput(*block, segment, fNofWorkers, -1);
+				continue;
+			}
+			fBoardCounter = segment.fLastBoardCounter;
+		}
+		for(size_t i = segment.fFirstHit; i < segment.fFirstHit + segment.fNofHits; ++i) {
+			if(fHitOutput != nullptr) {
+				(*fHitOutput)(block->fHits[i]);
+			} else {
+				*event = block->fEvents[i];
+				(*fEventOutput)(*event);
+			}
+		}
+		if(fDebug > 3) {
+			std::cout<<"got "<<segment.fNofHits<<" events from this segment"<<std::endl;
+		}
+	}
+}
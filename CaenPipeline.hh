@@ -0,0 +1,110 @@
+#ifndef CAENPIPELINE_HH
+#define CAENPIPELINE_HH
+#include <vector>
+#include <deque>
+#include <map>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <cstdint>
+
+#include "CaenEvent.hh"
+#include "CaenHit.hh"
+#include "CaenDecoder.hh"
+#include "CaenSpan.hh"
+
+// multi-threaded decoding of DPP-PSD data
+// a reader thread fills blocks of raw data, a pool of workers decodes them, and the calling thread gets
+// all hits in the same order as a single decoder would have produced them
+// with a single worker no threads are started and the hits are passed on straight from the decoder
+class CaenPipeline {
+public:
+	// part of a block that is decoded in one go (e.g. one MIDAS bank or one board aggregate)
+	struct Segment {
+		size_t   fOffset;   // in words from the start of the block data
+		int      fNofWords;
+		// filled by the decoding
+		size_t   fFirstHit;
+		size_t   fNofHits;
+		uint32_t fNofBoardAggregates;
+		uint32_t fFirstBoardCounter;
+		uint32_t fLastBoardCounter;
+	};
+
+	struct Block {
+		uint64_t fSequence;
+		std::vector<uint32_t> fBuffer; // storage for data that doesn't stay valid (e.g. MIDAS events)
+		const uint32_t* fData;
+		std::vector<Segment> fSegments;
+		// decoded hits, either as events or as compact hits, both are re-used, so only the first fNofHits are valid
+		std::vector<CaenEvent> fEvents;
+		std::vector<CaenHit> fHits;
+		size_t fNofHits;
+
+		void Clear() { fData = nullptr; fSegments.clear(); fNofHits = 0; }
+		void AddSegment(size_t offset, int nofWords) { fSegments.push_back(Segment{offset, nofWords, 0, 0, 0, 0, 0}); }
+	};
+
+	CaenPipeline(int nofWorkers, int debug = 0);
+	~CaenPipeline() {}
+
+	// reader(Block&) gets a cleared block to fill, and returns false once there is no more data
+	// output(const CaenEvent&) is called from the calling thread for each hit, the hit is always OutputEvent()
+	void Run(const std::function<bool(Block&)>& reader, const std::function<void(const CaenEvent&)>& output);
+	// same, but the hits are decoded as compact hits without waveforms
+	void Run(const std::function<bool(Block&)>& reader, const std::function<void(const CaenHit&)>& output);
+
+	// the event passed to the output, e.g. to use as branch address
+	CaenEvent* OutputEvent() { return fDecoder.Event(); }
+
+	int NofWorkers() const { return fNofWorkers; }
+
+	// what to decode, used by all decoders (has to be set before Run)
+	void SetDecoderOptions(const CaenDecoder::Options& options) { fDecoder.SetOptions(options); }
+
+	// optional batch output, called with all hits of a segment in the thread that decoded them (as thread 0 to NofWorkers()-1),
+	// so e.g. histograms can be filled in parallel with one instance per thread (up to NofBatchThreads())
+	// a segment that is rejected later (because its board counter went back) is passed again with weight -1 from the output thread
+	// (as thread NofWorkers()), so the batch output has to be able to subtract the hits again
+	// only the one matching the type of the Run call is used
+	void SetHitBatchOutput(const std::function<void(int, CaenSpan<CaenHit>, int)>& output) { fHitBatchOutput = output; }
+	void SetEventBatchOutput(const std::function<void(int, CaenSpan<CaenEvent>, int)>& output) { fEventBatchOutput = output; }
+	int NofBatchThreads() const { return fNofWorkers + 1; }
+
+private:
+	CaenPipeline(const CaenPipeline&) = delete;
+	CaenPipeline& operator=(const CaenPipeline&) = delete;
+
+	void RunThreads(const std::function<bool(Block&)>& reader);
+	void RunSequential(const std::function<bool(Block&)>& reader);
+	void ReaderLoop(const std::function<bool(Block&)>& reader);
+	void WorkerLoop(int thread);
+	void Output(Block* block);
+	// decodes the segment into the hits (or events) of the block, and passes them to the batch output
+	void DecodeSegment(CaenDecoder& decoder, Block& block, Segment& segment, int thread);
+	void BatchOutput(const Block& block, const Segment& segment, int thread, int weight);
+
+	int fNofWorkers;
+	int fDebug;
+	CaenDecoder fDecoder; // used for sequential decoding and to hold the output event
+
+	// only one of these is set, depending on whether events or compact hits are decoded
+	const std::function<void(const CaenEvent&)>* fEventOutput;
+	const std::function<void(const CaenHit&)>* fHitOutput;
+	std::function<void(int, CaenSpan<CaenHit>, int)> fHitBatchOutput;
+	std::function<void(int, CaenSpan<CaenEvent>, int)> fEventBatchOutput;
+
+	std::vector<Block> fBlocks;
+	std::deque<Block*> fFree;          // blocks available to the reader
+	std::deque<Block*> fRead;          // blocks waiting to be decoded
+	std::map<uint64_t, Block*> fDecoded; // decoded blocks waiting for the output, by sequence number
+	std::mutex fMutex;
+	std::condition_variable fCondition;
+	uint64_t fNofBlocksRead;
+	bool fReaderDone;
+
+	// board counter check across blocks, the decoders of the workers only check within a segment
+	uint32_t fBoardCounter;
+};
+#endif
@@ -0,0 +1,73 @@
+#include "CaenRNTuple.hh"
+
+#ifdef USE_RNTUPLE
+CaenRNTuple::CaenRNTuple(const std::string& name, TFile& file, size_t pageSize, int compression)
+{
+	auto model = CaenNTuple::RNTupleModel::Create();
+	fChannel           = model->MakeField<int32_t>("channel");
+	fTriggerTime       = model->MakeField<uint32_t>("triggerTime");
+	fExtendedTimestamp = model->MakeField<uint16_t>("extendedTimestamp");
+	fTimestamp         = model->MakeField<uint64_t>("timestamp");
+	fCfd               = model->MakeField<uint16_t>("cfd");
+	fCharge            = model->MakeField<uint16_t>("charge");
+	fShortGate         = model->MakeField<uint16_t>("shortGate");
+	fLostTrigger       = model->MakeField<bool>("lostTrigger");
+	fOverRange         = model->MakeField<bool>("overRange");
+	fKiloCount         = model->MakeField<bool>("kiloCount");
+	fNLostCount        = model->MakeField<bool>("nLostCount");
+	fWaveforms         = model->MakeField<std::vector<std::vector<uint16_t> > >("waveforms");
+	fDigitalWaveforms  = model->MakeField<std::vector<std::vector<uint8_t> > >("digitalWaveforms");
+
+	CaenNTuple::RNTupleWriteOptions options;
+	if(pageSize > 0) {
+#if ROOT_VERSION_CODE >= ROOT_VERSION(6,34,0)
+		// pages grow from the initial size up to the maximum, which has to be at least the initial size
+		if(options.GetInitialUnzippedPageSize() > pageSize) options.SetInitialUnzippedPageSize(pageSize);
+		options.SetMaxUnzippedPageSize(pageSize);
+#else
+		options.SetApproxUnzippedPageSize(pageSize);
+#endif
+	}
+	if(compression >= 0) options.SetCompression(compression);
+
+	fWriter = CaenNTuple::RNTupleWriter::Append(std::move(model), name, file, options);
+}
+
+CaenRNTuple::~CaenRNTuple()
+{
+	Close();
+}
+
+void CaenRNTuple::Fill(const CaenEvent& event)
+{
+	*fChannel           = event.Channel();
+	*fTriggerTime       = event.TriggerTime();
+	*fExtendedTimestamp = event.ExtendedTimestamp();
+	*fTimestamp         = event.GetTimestamp();
+	*fCfd               = event.Cfd();
+	*fCharge            = event.Charge();
+	*fShortGate         = event.ShortGate();
+	*fLostTrigger       = event.LostTrigger();
+	*fOverRange         = event.OverRange();
+	*fKiloCount         = event.KiloCount();
+	*fNLostCount        = event.NLostCount();
+	// resize only, so the inner vectors keep their memory
+	fWaveforms->resize(event.NofWaveforms());
+	for(size_t i = 0; i < fWaveforms->size(); ++i) {
+		auto waveform = event.Waveform(i);
+		(*fWaveforms)[i].assign(waveform.begin(), waveform.end());
+	}
+	fDigitalWaveforms->resize(event.NofDigitalWaveforms());
+	for(size_t i = 0; i < fDigitalWaveforms->size(); ++i) {
+		auto waveform = event.DigitalWaveform(i);
+		(*fDigitalWaveforms)[i].assign(waveform.begin(), waveform.end());
+	}
+	fWriter->Fill();
+}
+
+void CaenRNTuple::Close()
+{
+	// destroying the writer commits the last cluster and writes the footer
+	fWriter.reset();
+}
+#endif
@@ -0,0 +1,67 @@
+#ifndef CAENRNTUPLE_HH
+#define CAENRNTUPLE_HH
+// RNTuple output, only available if compiled with USE_RNTUPLE (make RNTUPLE=1),
+// which needs ROOT 6.28 or newer (built with root7) and C++17
+#ifdef USE_RNTUPLE
+#include <memory>
+#include <vector>
+#include <string>
+#include <cstdint>
+
+#include "RVersion.h"
+#include "TFile.h"
+// the writer classes moved from ROOT::Experimental to ROOT with 6.36 (6.34 only moved the RNTuple anchor),
+// their headers were split from RNTuple.hxx and RNTupleOptions.hxx before that
+#include "ROOT/RNTupleModel.hxx"
+#if __has_include("ROOT/RNTupleWriter.hxx")
+#include "ROOT/RNTupleWriter.hxx"
+#else
+#include "ROOT/RNTuple.hxx"
+#endif
+#if __has_include("ROOT/RNTupleWriteOptions.hxx")
+#include "ROOT/RNTupleWriteOptions.hxx"
+#else
+#include "ROOT/RNTupleOptions.hxx"
+#endif
+#if ROOT_VERSION_CODE >= ROOT_VERSION(6,36,0)
+namespace CaenNTuple = ROOT;
+#else
+namespace CaenNTuple = ROOT::Experimental;
+#endif
+
+#include "CaenEvent.hh"
+
+// writes hits as an RNTuple with the same fields as CaenEvent, the waveforms are stored as collections
+class CaenRNTuple {
+public:
+	// appends the RNTuple to file, pageSize (approximate uncompressed page size in bytes) and compression (ROOT compression
+	// setting, e.g. 505 for zstd level 5) are only used if they are positive
+	CaenRNTuple(const std::string& name, TFile& file, size_t pageSize = 0, int compression = -1);
+	~CaenRNTuple();
+
+	void Fill(const CaenEvent& event);
+	// writes the remaining data, also done by the destructor
+	void Close();
+
+private:
+	CaenRNTuple(const CaenRNTuple&) = delete;
+	CaenRNTuple& operator=(const CaenRNTuple&) = delete;
+
+	std::unique_ptr<CaenNTuple::RNTupleWriter> fWriter;
+
+	std::shared_ptr<int32_t>  fChannel;
+	std::shared_ptr<uint32_t> fTriggerTime;
+	std::shared_ptr<uint16_t> fExtendedTimestamp;
+	std::shared_ptr<uint64_t> fTimestamp;
+	std::shared_ptr<uint16_t> fCfd;
+	std::shared_ptr<uint16_t> fCharge;
+	std::shared_ptr<uint16_t> fShortGate;
+	std::shared_ptr<bool>     fLostTrigger;
+	std::shared_ptr<bool>     fOverRange;
+	std::shared_ptr<bool>     fKiloCount;
+	std::shared_ptr<bool>     fNLostCount;
+	std::shared_ptr<std::vector<std::vector<uint16_t> > > fWaveforms;
+	std::shared_ptr<std::vector<std::vector<uint8_t> > >  fDigitalWaveforms;
+};
+#endif
+#endif
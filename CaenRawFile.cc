@@ -0,0 +1,198 @@
+#include "CaenRawFile.hh"
+
+#include <iostream>
+#include <algorithm>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+// how much of the already read part of a memory-mapped file is kept before it's released
+// (the decoding threads might still be working on it, but releasing it early would only cost re-reading it)
+static const size_t gKeepMappedBytes = 64*1024*1024;
+
+CaenRawFile::CaenRawFile(size_t chunkWords, int debug)
+	: fChunkWords(chunkWords), fDebug(debug), fFileSize(0), fBytesRead(0),
+	  fFile(-1), fMapped(nullptr), fPosition(0), fReleased(0),
+	  fStream(nullptr), fEof(false)
+{
+}
+
+CaenRawFile::~CaenRawFile()
+{
+	Close();
+}
+
+bool CaenRawFile::Open(const std::string& fileName, bool useMmap)
+{
+	Close();
+	fFile = open(fileName.c_str(), O_RDONLY);
+	if(fFile < 0) {
+		return false;
+	}
+	struct stat fileStat;
+	if(fstat(fFile, &fileStat) != 0) {
+		Close();
+		return false;
+	}
+	fFileSize = fileStat.st_size;
+
+	if(useMmap && fFileSize > 0) {
+		void* mapped = mmap(nullptr, fFileSize, PROT_READ, MAP_PRIVATE, fFile, 0);
+		if(mapped != MAP_FAILED) {
+			madvise(mapped, fFileSize, MADV_SEQUENTIAL);
+			fMapped = static_cast<const uint32_t*>(mapped);
+			if(fDebug > 0) {
+				std::cout<<"memory-mapped "<<fileName<<" ("<<fFileSize<<" bytes)"<<std::endl;
+			}
+			return true;
+		}
+		std::cerr<<"Failed to memory-map "<<fileName<<", reading it in chunks instead"<<std::endl;
+	}
+
+	fStream = fdopen(fFile, "rb");
+	if(fStream == nullptr) {
+		Close();
+		return false;
+	}
+	fFile = -1; // now owned by the stream
+	if(fDebug > 0) {
+		std::cout<<"reading "<<fileName<<" ("<<fFileSize<<" bytes) in chunks of "<<fChunkWords*4<<" bytes"<<std::endl;
+	}
+	return true;
+}
+
+void CaenRawFile::Close()
+{
+	if(fMapped != nullptr) {
+		munmap(const_cast<uint32_t*>(fMapped), fFileSize);
+		fMapped = nullptr;
+	}
+	if(fFile >= 0) {
+		close(fFile);
+		fFile = -1;
+	}
+	if(fStream != nullptr) {
+		fclose(fStream);
+		fStream = nullptr;
+	}
+	fFileSize = 0;
+	fBytesRead = 0;
+	fPosition = 0;
+	fReleased = 0;
+	fEof = false;
+	fCarry.clear();
+}
+
+bool CaenRawFile::Read(CaenPipeline::Block& block)
+{
+	if(fMapped != nullptr) return ReadMapped(block);
+	if(fStream != nullptr) return ReadChunk(block);
+	return false;
+}
+
+uint32_t CaenRawFile::HeaderSize(const uint32_t* data, size_t pos) const
+{
+	if((data[pos]>>28) != 0xa) {
+		std::cout<<"0x"<<std::hex<<data[pos]<<std::dec<<": not a header, skipping"<<std::endl;
+		return 0;
+	}
+	uint32_t numWords = data[pos]&0xfffffff;
+	if(numWords == 0) {
+		std::cout<<"0x"<<std::hex<<data[pos]<<std::dec<<": header without data, skipping"<<std::endl;
+	}
+	return numWords;
+}
+
+bool CaenRawFile::ReadMapped(CaenPipeline::Block& block)
+{
+	size_t fileWords = fFileSize/4;
+	size_t blockWords = 0;
+	block.fData = fMapped;
+	while(fPosition < fileWords && blockWords < fChunkWords) {
+		// read data size (in 32-bit words) from header, the decoder complains about missing words if it's too large
+		uint32_t numWords = HeaderSize(fMapped, fPosition);
+		if(numWords == 0) {
+			++fPosition;
+			continue;
+		}
+		numWords = std::min(static_cast<size_t>(numWords), fileWords - fPosition);
+		block.AddSegment(fPosition, numWords);
+		fPosition += numWords;
+		blockWords += numWords;
+	}
+	fBytesRead = 4*fPosition;
+
+	// release the pages we're done with, they are only re-read from the file if they are still needed
+	size_t pageSize = sysconf(_SC_PAGESIZE);
+	if(fBytesRead > fReleased + 2*gKeepMappedBytes) {
+		size_t release = ((fBytesRead - gKeepMappedBytes)/pageSize)*pageSize;
+		madvise(const_cast<char*>(reinterpret_cast<const char*>(fMapped)) + fReleased, release - fReleased, MADV_DONTNEED);
+		fReleased = release;
+	}
+
+	return !block.fSegments.empty();
+}
+
+void CaenRawFile::Fill(std::vector<uint32_t>& buffer, size_t nofWords)
+{
+	size_t size = buffer.size();
+	buffer.resize(size + nofWords);
+	size_t read = fread(buffer.data() + size, sizeof(uint32_t), nofWords, fStream);
+	buffer.resize(size + read);
+	fBytesRead += 4*read;
+	if(read < nofWords) {
+		fEof = true;
+	}
+}
+
+bool CaenRawFile::ReadChunk(CaenPipeline::Block& block)
+{
+	// the block owns the data, so the buffer of the block is re-used for each chunk
+	std::vector<uint32_t>& buffer = block.fBuffer;
+	buffer.assign(fCarry.begin(), fCarry.end());
+	fCarry.clear();
+	size_t pos = 0;
+	while(block.fSegments.empty()) {
+		if(pos == buffer.size()) {
+			// nothing but skipped words so far, no need to keep them
+			buffer.clear();
+			pos = 0;
+		}
+		if(!fEof && buffer.size() < pos + fChunkWords) {
+			Fill(buffer, pos + fChunkWords - buffer.size());
+		}
+		if(pos >= buffer.size()) {
+			break; // end of file
+		}
+		while(pos < buffer.size()) {
+			uint32_t numWords = HeaderSize(buffer.data(), pos);
+			if(numWords == 0) {
+				++pos;
+				continue;
+			}
+			if(pos + numWords > buffer.size()) {
+				if(fEof) {
+					// truncated file, the decoder will report the missing words
+					block.AddSegment(pos, buffer.size() - pos);
+					pos = buffer.size();
+					break;
+				}
+				if(block.fSegments.empty()) {
+					// aggregate larger than the chunk, read the rest of it
+					Fill(buffer, pos + numWords - buffer.size());
+					continue;
+				}
+				break; // the incomplete aggregate goes into the next block
+			}
+			block.AddSegment(pos, numWords);
+			pos += numWords;
+		}
+	}
+	fCarry.assign(buffer.begin() + pos, buffer.end());
+	buffer.resize(pos);
+	block.fData = buffer.data();
+
+	return !block.fSegments.empty();
+}
@@ -0,0 +1,57 @@
+#ifndef CAENRAWFILE_HH
+#define CAENRAWFILE_HH
+#include <string>
+#include <vector>
+#include <cstdio>
+#include <cstdint>
+
+#include "CaenPipeline.hh"
+
+// input of raw aggregate files (as written by the frontend), in blocks of complete board aggregates
+// the file is memory-mapped if possible, pages that have been read are released again so the memory used stays constant
+// otherwise the file is read in chunks into the blocks, an aggregate split between two chunks is carried over to the next block
+class CaenRawFile {
+public:
+	CaenRawFile(size_t chunkWords = 1<<18, int debug = 0);
+	~CaenRawFile();
+
+	// memory-maps the file unless useMmap is false or mapping fails, in which case it's read in chunks
+	bool Open(const std::string& fileName, bool useMmap = true);
+	void Close();
+
+	// fills the block with the next board aggregates (roughly chunkWords words), each as its own segment
+	// returns false once the end of the file is reached
+	bool Read(CaenPipeline::Block& block);
+
+	size_t FileSize() const { return fFileSize; }
+	size_t BytesRead() const { return fBytesRead; }
+	bool Mapped() const { return fMapped != nullptr; }
+
+private:
+	CaenRawFile(const CaenRawFile&) = delete;
+	CaenRawFile& operator=(const CaenRawFile&) = delete;
+
+	bool ReadMapped(CaenPipeline::Block& block);
+	bool ReadChunk(CaenPipeline::Block& block);
+	// reads up to nofWords more words from the file and appends them to buffer
+	void Fill(std::vector<uint32_t>& buffer, size_t nofWords);
+	// checks the word at pos for a board aggregate header and returns its size in words, or zero if it's not a header
+	uint32_t HeaderSize(const uint32_t* data, size_t pos) const;
+
+	size_t fChunkWords;
+	int fDebug;
+	size_t fFileSize;
+	size_t fBytesRead;
+
+	// memory-mapped input
+	int fFile;
+	const uint32_t* fMapped;
+	size_t fPosition; // in words
+	size_t fReleased; // in bytes, pages before this have been released
+
+	// chunked input
+	FILE* fStream;
+	bool fEof;
+	std::vector<uint32_t> fCarry; // start of an incomplete aggregate from the last chunk
+};
+#endif
@@ -0,0 +1,38 @@
+#ifndef CAENSPAN_HH
+#define CAENSPAN_HH
+#include <cstddef>
+#include <vector>
+#include <algorithm>
+#include <stdexcept>
+
+// non-owning, read-only view of a contiguous range of values (C++11 stand-in for std::span<const T>)
+// only valid as long as the storage it points to isn't changed
+template<typename T>
+class CaenSpan {
+public:
+	CaenSpan() : fData(nullptr), fSize(0) {}
+	CaenSpan(const T* data, size_t size) : fData(data), fSize(size) {}
+	CaenSpan(const std::vector<T>& vec) : fData(vec.data()), fSize(vec.size()) {}
+
+	const T* data() const { return fData; }
+	size_t size() const { return fSize; }
+	bool empty() const { return fSize == 0; }
+	const T* begin() const { return fData; }
+	const T* end() const { return fData + fSize; }
+	const T& operator[](size_t i) const { return fData[i]; }
+	const T& at(size_t i) const {
+		if(i >= fSize) throw std::out_of_range("CaenSpan::at");
+		return fData[i];
+	}
+
+	// copy, for code that needs (or used to get) a vector
+	operator std::vector<T>() const { return std::vector<T>(begin(), end()); }
+
+	bool operator==(const CaenSpan& rhs) const { return fSize == rhs.fSize && std::equal(begin(), end(), rhs.begin()); }
+	bool operator!=(const CaenSpan& rhs) const { return !(*this == rhs); }
+
+private:
+	const T* fData;
+	size_t fSize;
+};
+#endif
@@ -0,0 +1,144 @@
+#ifndef CAENTIMESORTER_HH
+#define CAENTIMESORTER_HH
+#include <vector>
+#include <cstdint>
+#include <iostream>
+
+// streaming time-ordering of hits (CaenEvent or CaenHit) from all channels
+// the hits of each channel arrive (almost) in time order, but the channels (and boards) are interleaved aggregate by aggregate,
+// so each channel of each board gets its own sorted queue, and the queues are merged
+// a hit is passed on once the newest hit seen is more than the lookahead window later, so the memory used only
+// depends on the window (and the rate), not on the length of the run
+// hits that arrive after a later hit has already been passed on are passed on right away and counted as late,
+// if there are any the window is too small
+// the time used for sorting is either GetTimePs() of the hit or given explicitly (e.g. from CaenTimestampUnwrapper),
+// it's passed on to the sink together with the hit
+template<typename Hit>
+class CaenTimeSorter {
+public:
+	// window in ns
+	CaenTimeSorter(double window = 10000.)
+		: fWindow(static_cast<uint64_t>(window*1000.)), fNewest(0), fLastKey(0), fNofBuffered(0), fMaxBuffered(0), fNofLate(0) {}
+
+	// adds the hit and passes all hits that are older than the newest one minus the window to sink(const Hit&, uint64_t time)
+	template<typename Sink>
+	void Add(const Hit& hit, Sink&& sink) {
+		Add(hit, hit.GetTimePs(), sink);
+	}
+
+	// same with the time in ps given explicitly
+	template<typename Sink>
+	void Add(const Hit& hit, uint64_t key, Sink&& sink) {
+		if(key < fLastKey) {
+			++fNofLate;
+			sink(hit, key);
+			return;
+		}
+		size_t queue = hit.Board()*kChannelsPerBoard + hit.Channel();
+		if(queue >= fQueues.size()) {
+			fQueues.resize(queue + 1);
+		}
+		if(fQueues[queue].Empty()) {
+			fActive.push_back(queue);
+		}
+		fQueues[queue].Push(hit, key);
+		if(++fNofBuffered > fMaxBuffered) fMaxBuffered = fNofBuffered;
+		if(key > fNewest) fNewest = key;
+		if(fNewest >= fWindow) {
+			Drain(fNewest - fWindow, sink);
+		}
+	}
+
+	// passes all remaining hits to the sink, e.g. at the end of the run
+	template<typename Sink>
+	void Flush(Sink&& sink) {
+		Drain(UINT64_MAX, sink);
+	}
+
+	size_t NofBuffered() const { return fNofBuffered; }
+	size_t MaxBuffered() const { return fMaxBuffered; }
+	uint64_t NofLate() const { return fNofLate; }
+
+private:
+	// sorted queue of the hits of one channel, kept as ring buffer so the hits (and their waveform memory) are re-used
+	class Queue {
+	public:
+		Queue() : fFirst(0), fSize(0) {}
+
+		bool Empty() const { return fSize == 0; }
+		const Hit& Front() const { return fHits[fFirst]; }
+		uint64_t FrontKey() const { return fKeys[fFirst]; }
+		void Pop() { fFirst = Next(fFirst); --fSize; }
+
+		void Push(const Hit& hit, uint64_t key) {
+			if(fSize == fHits.size()) Grow();
+			// normally the hit goes to the end, otherwise later hits are moved back by one
+			size_t pos = Index(fSize);
+			size_t n = fSize;
+			for(; n > 0 && fKeys[Index(n - 1)] > key; --n) {
+				fHits[Index(n)] = fHits[Index(n - 1)];
+				fKeys[Index(n)] = fKeys[Index(n - 1)];
+				pos = Index(n - 1);
+			}
+			fHits[pos] = hit;
+			fKeys[pos] = key;
+			++fSize;
+		}
+
+	private:
+		size_t Index(size_t i) const { return (fFirst + i)%fHits.size(); }
+		size_t Next(size_t i) const { return (i + 1 == fHits.size()) ? 0 : i + 1; }
+		void Grow() {
+			std::vector<Hit> hits(fHits.empty() ? 16 : 2*fHits.size());
+			std::vector<uint64_t> keys(hits.size());
+			for(size_t i = 0; i < fSize; ++i) {
+				hits[i] = fHits[Index(i)];
+				keys[i] = fKeys[Index(i)];
+			}
+			fHits.swap(hits);
+			fKeys.swap(keys);
+			fFirst = 0;
+		}
+
+		std::vector<Hit> fHits;
+		std::vector<uint64_t> fKeys;
+		size_t fFirst;
+		size_t fSize;
+	};
+
+	// k-way merge of the queues, only the non-empty ones are searched, these are the channels that had hits within the
+	// window, which are few enough that a linear search over their fronts is cheaper than keeping a heap up to date
+	template<typename Sink>
+	void Drain(uint64_t limit, Sink& sink) {
+		while(fNofBuffered > 0) {
+			size_t oldest = 0;
+			for(size_t i = 1; i < fActive.size(); ++i) {
+				if(fQueues[fActive[i]].FrontKey() < fQueues[fActive[oldest]].FrontKey()) {
+					oldest = i;
+				}
+			}
+			Queue& queue = fQueues[fActive[oldest]];
+			if(queue.FrontKey() > limit) break;
+			fLastKey = queue.FrontKey();
+			sink(queue.Front(), fLastKey);
+			queue.Pop();
+			--fNofBuffered;
+			if(queue.Empty()) {
+				fActive[oldest] = fActive.back();
+				fActive.pop_back();
+			}
+		}
+	}
+
+	static const size_t kChannelsPerBoard = 16;
+
+	uint64_t fWindow;  // in ps
+	uint64_t fNewest;  // newest key seen
+	uint64_t fLastKey; // key of the last hit passed on
+	std::vector<Queue> fQueues;
+	std::vector<size_t> fActive; // indices of the non-empty queues
+	size_t fNofBuffered;
+	size_t fMaxBuffered;
+	uint64_t fNofLate;
+};
+#endif
@@ -0,0 +1,77 @@
+#ifndef CAENTIMESTAMPUNWRAPPER_HH
+#define CAENTIMESTAMPUNWRAPPER_HH
+#include <vector>
+#include <cstddef>
+#include <cstdint>
+
+// turns the timestamps of the hits (CaenEvent or CaenHit) into a monotonic 64-bit time in ps
+// the timestamp counter rolls over after 47 bits (extended timestamp and trigger time, ~3.3 days) or,
+// without an extended timestamp in the extras word, after the 31 bits of the trigger time (~4.3 s)
+// all channels of a board share one time counter, so the rollovers are tracked per board (by the board ID the decoder
+// stores in the hit) and any hit of the board advances it, boards don't roll over at the same moment, so they can't
+// share one tracker
+// the channels of a board are read aggregate by aggregate, so their hits are only roughly in time order: a timestamp
+// that goes back by more than half the counter range means the counter rolled over, one that goes forward by more than
+// half the range is a late hit from before the last rollover
+// once a timestamp used more than 31 bits the counter can only roll over at 47 bits
+class CaenTimestampUnwrapper {
+public:
+	CaenTimestampUnwrapper() {}
+
+	// returns the unwrapped time of the hit in ps (in 64 bits that's enough for ~200 days)
+	template<typename Hit>
+	uint64_t Unwrap(const Hit& hit) {
+		size_t index = hit.Board();
+		if(index >= fBoards.size()) {
+			fBoards.resize(index + 1);
+		}
+		Board& board = fBoards[index];
+		uint64_t timestamp = hit.GetTimestamp();
+		if((timestamp>>31) != 0) {
+			board.fRange = UINT64_C(1)<<47;
+		}
+		uint64_t offset = board.fOffset;
+		if(!board.fSeen) {
+			board.fLast = timestamp;
+			board.fSeen = true;
+		} else if(timestamp < board.fLast) {
+			if(board.fLast - timestamp > board.fRange/2) {
+				board.fOffset += board.fRange;
+				++board.fNofRollovers;
+				offset = board.fOffset;
+				board.fLast = timestamp;
+			}
+		} else if(timestamp - board.fLast > board.fRange/2 && board.fOffset >= board.fRange) {
+			offset -= board.fRange;
+		} else {
+			board.fLast = timestamp;
+		}
+		// 2000 ps per timestamp tick, the CFD is 1/1024 of a tick
+		return (offset + timestamp)*2000 + ((hit.Cfd()*125)>>6);
+	}
+
+	// number of rollovers seen in all boards
+	uint64_t NofRollovers() const {
+		uint64_t result = 0;
+		for(const auto& board : fBoards) {
+			result += board.fNofRollovers;
+		}
+		return result;
+	}
+
+	void Reset() { fBoards.clear(); }
+
+private:
+	struct Board {
+		uint64_t fLast;   // newest raw timestamp
+		uint64_t fOffset; // added to the raw timestamps, in ticks
+		uint64_t fRange;  // range of the counter, in ticks
+		uint64_t fNofRollovers;
+		bool fSeen;
+
+		Board() : fLast(0), fOffset(0), fRange(UINT64_C(1)<<31), fNofRollovers(0), fSeen(false) {}
+	};
+
+	std::vector<Board> fBoards;
+};
+#endif
@@ -0,0 +1,125 @@
+#ifndef CAENUNPACK_HH
+#define CAENUNPACK_HH
+#include <cstdint>
+#include <cstddef>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+// bulk unpacking of DPP-PSD waveform words
+// each 32-bit word holds two samples: [13:0] sample, 14 digital probe 1, 15 digital probe 2,
+// [29:16] next sample, 30 digital probe 1, 31 digital probe 2
+// in single trace mode both samples belong to the first analog trace, in dual trace mode the sample in the
+// low half belongs to the second trace and the one in the high half to the first trace
+// the digital probes always have two samples per word
+// all output arrays have to be pre-sized by the caller:
+// digital0/digital1 and (single trace) trace0 need 2*nofWords entries, in dual trace mode trace0/trace1 need nofWords entries
+// digital0 and digital1 can both be null to skip the digital probes
+// AVX2 is used if the code is compiled with it (-mavx2 or -march=native), otherwise SSE2 on x86-64 and plain C++ elsewhere
+namespace CaenUnpack {
+	// plain C++ version, also used for the words left over by the vectorized versions
+	inline void UnpackScalar(const uint32_t* words, size_t nofWords, bool dualTrace, uint16_t* trace0, uint16_t* trace1, uint8_t* digital0, uint8_t* digital1) {
+		for(size_t s = 0; s < nofWords; ++s) {
+			uint32_t word = words[s];
+			if(dualTrace) {
+				trace1[s] = word&0x3fff;
+				trace0[s] = (word>>16)&0x3fff;
+			} else {
+				trace0[2*s]   = word&0x3fff;
+				trace0[2*s+1] = (word>>16)&0x3fff;
+			}
+			if(digital0 != nullptr) {
+				digital0[2*s]   = (word>>14)&0x1;
+				digital0[2*s+1] = (word>>30)&0x1;
+				digital1[2*s]   = (word>>15)&0x1;
+				digital1[2*s+1] = (word>>31)&0x1;
+			}
+		}
+	}
+
+#if defined(__AVX2__)
+	// 8 words (16 samples) per iteration
+	inline void Unpack(const uint32_t* words, size_t nofWords, bool dualTrace, uint16_t* trace0, uint16_t* trace1, uint8_t* digital0, uint8_t* digital1) {
+		const __m256i sampleMask = _mm256_set1_epi16(0x3fff);
+		const __m256i bitMask    = _mm256_set1_epi16(0x1);
+		const __m256i lowMask    = _mm256_set1_epi32(0x3fff);
+		size_t s = 0;
+		for(; s + 8 <= nofWords; s += 8) {
+			// seen as 16-bit values the words are already in sample order
+			__m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(words + s));
+			if(dualTrace) {
+				// packs works within each 128-bit lane, the permute puts the two 64-bit halves of each lane in order
+				__m256i low  = _mm256_and_si256(v, lowMask);
+				__m256i high = _mm256_and_si256(_mm256_srli_epi32(v, 16), lowMask);
+				__m256i packed = _mm256_permute4x64_epi64(_mm256_packs_epi32(low, high), 0xd8);
+				_mm_storeu_si128(reinterpret_cast<__m128i*>(trace1 + s), _mm256_castsi256_si128(packed));
+				_mm_storeu_si128(reinterpret_cast<__m128i*>(trace0 + s), _mm256_extracti128_si256(packed, 1));
+			} else {
+				_mm256_storeu_si256(reinterpret_cast<__m256i*>(trace0 + 2*s), _mm256_and_si256(v, sampleMask));
+			}
+			if(digital0 != nullptr) {
+				__m256i d0 = _mm256_and_si256(_mm256_srli_epi16(v, 14), bitMask);
+				__m256i d1 = _mm256_srli_epi16(v, 15);
+				__m256i d = _mm256_permute4x64_epi64(_mm256_packus_epi16(d0, d1), 0xd8);
+				_mm_storeu_si128(reinterpret_cast<__m128i*>(digital0 + 2*s), _mm256_castsi256_si128(d));
+				_mm_storeu_si128(reinterpret_cast<__m128i*>(digital1 + 2*s), _mm256_extracti128_si256(d, 1));
+			}
+		}
+		if(digital0 != nullptr) {
+			digital0 += 2*s;
+			digital1 += 2*s;
+		}
+		if(dualTrace) {
+			UnpackScalar(words + s, nofWords - s, dualTrace, trace0 + s, trace1 + s, digital0, digital1);
+		} else {
+			UnpackScalar(words + s, nofWords - s, dualTrace, trace0 + 2*s, trace1, digital0, digital1);
+		}
+	}
+#elif defined(__SSE2__)
+	// 4 words (8 samples) per iteration
+	inline void Unpack(const uint32_t* words, size_t nofWords, bool dualTrace, uint16_t* trace0, uint16_t* trace1, uint8_t* digital0, uint8_t* digital1) {
+		const __m128i sampleMask = _mm_set1_epi16(0x3fff);
+		const __m128i bitMask    = _mm_set1_epi16(0x1);
+		const __m128i lowMask    = _mm_set1_epi32(0x3fff);
+		size_t s = 0;
+		for(; s + 4 <= nofWords; s += 4) {
+			// seen as 16-bit values the words are already in sample order
+			__m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(words + s));
+			if(dualTrace) {
+				// samples are masked to 14 bits, so the signed saturation of packs never kicks in
+				__m128i low  = _mm_and_si128(v, lowMask);
+				__m128i high = _mm_and_si128(_mm_srli_epi32(v, 16), lowMask);
+				__m128i packed = _mm_packs_epi32(low, high);
+				_mm_storel_epi64(reinterpret_cast<__m128i*>(trace1 + s), packed);
+				_mm_storel_epi64(reinterpret_cast<__m128i*>(trace0 + s), _mm_srli_si128(packed, 8));
+			} else {
+				_mm_storeu_si128(reinterpret_cast<__m128i*>(trace0 + 2*s), _mm_and_si128(v, sampleMask));
+			}
+			if(digital0 != nullptr) {
+				__m128i d0 = _mm_and_si128(_mm_srli_epi16(v, 14), bitMask);
+				__m128i d1 = _mm_srli_epi16(v, 15);
+				__m128i d = _mm_packus_epi16(d0, d1);
+				_mm_storel_epi64(reinterpret_cast<__m128i*>(digital0 + 2*s), d);
+				_mm_storel_epi64(reinterpret_cast<__m128i*>(digital1 + 2*s), _mm_srli_si128(d, 8));
+			}
+		}
+		if(digital0 != nullptr) {
+			digital0 += 2*s;
+			digital1 += 2*s;
+		}
+		if(dualTrace) {
+			UnpackScalar(words + s, nofWords - s, dualTrace, trace0 + s, trace1 + s, digital0, digital1);
+		} else {
+			UnpackScalar(words + s, nofWords - s, dualTrace, trace0 + 2*s, trace1, digital0, digital1);
+		}
+	}
+#else
+	inline void Unpack(const uint32_t* words, size_t nofWords, bool dualTrace, uint16_t* trace0, uint16_t* trace1, uint8_t* digital0, uint8_t* digital1) {
+		UnpackScalar(words, nofWords, dualTrace, trace0, trace1, digital0, digital1);
+	}
+#endif
+}
+#endif
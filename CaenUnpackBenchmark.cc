@@ -0,0 +1,130 @@
+// microbenchmark of the waveform unpacking: per-sample AddWaveformSample calls vs. the bulk unpacking of CaenUnpack.hh
+// usage: CaenUnpackBenchmark [number of samples per trace (multiple of 8)] [number of traces] [dual trace (0/1)]
+#include <iostream>
+#include <iomanip>
+#include <vector>
+#include <random>
+#include <chrono>
+#include <cstdlib>
+
+#include "CaenEvent.hh"
+#include "CaenUnpack.hh"
+
+// the loop used by the decoder before the bulk unpacking
+void UnpackPerSample(CaenEvent& event, const uint32_t* words, int nofWords, bool dualTrace)
+{
+	for(int s = 0; s < nofWords; ++s) {
+		event.AddDigitalWaveformSample(0, (words[s]>>14)&0x1);
+		event.AddDigitalWaveformSample(1, (words[s]>>15)&0x1);
+		if(dualTrace) {
+			event.AddWaveformSample(1, words[s]&0x3fff);
+			event.AddWaveformSample(0, (words[s]>>16)&0x3fff);
+		} else {
+			event.AddWaveformSample(0, words[s]&0x3fff);
+			event.AddWaveformSample(0, (words[s]>>16)&0x3fff);
+		}
+		event.AddDigitalWaveformSample(0, (words[s]>>30)&0x1);
+		event.AddDigitalWaveformSample(1, (words[s]>>31)&0x1);
+	}
+}
+
+template<typename Unpacker>
+void UnpackBulk(CaenEvent& event, const uint32_t* words, int nofWords, bool dualTrace, Unpacker unpack)
+{
+	uint16_t* trace0 = dualTrace ? event.ResizeWaveforms(2, nofWords) : event.ResizeWaveforms(1, 2*nofWords);
+	uint16_t* trace1 = dualTrace ? trace0 + nofWords : nullptr;
+	uint8_t* digital0 = event.ResizeDigitalWaveforms(2, 2*nofWords);
+	uint8_t* digital1 = digital0 + 2*nofWords;
+	unpack(words, nofWords, dualTrace, trace0, trace1, digital0, digital1);
+}
+
+bool Compare(const CaenEvent& first, const CaenEvent& second, bool dualTrace)
+{
+	for(size_t i = 0; i < (dualTrace ? 2 : 1); ++i) {
+		if(first.Waveform(i) != second.Waveform(i)) return false;
+	}
+	for(size_t i = 0; i < 2; ++i) {
+		if(first.DigitalWaveform(i) != second.DigitalWaveform(i)) return false;
+	}
+	return true;
+}
+
+// fresh = true: the event is newly created for each trace (as done by the decoder before it re-used its event)
+template<typename Function>
+double Time(const std::vector<uint32_t>& data, int nofWords, bool fresh, Function function)
+{
+	CaenEvent reused;
+	auto start = std::chrono::steady_clock::now();
+	for(size_t offset = 0; offset < data.size(); offset += nofWords) {
+		if(fresh) {
+			CaenEvent event;
+			function(event, data.data() + offset);
+		} else {
+			reused.Clear();
+			function(reused, data.data() + offset);
+		}
+	}
+	return std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+}
+
+int main(int argc, char** argv)
+{
+	int nofSamples = 192;
+	int nofTraces = 100000;
+	bool dualTrace = false;
+	if(argc > 1) nofSamples = atoi(argv[1]);
+	if(argc > 2) nofTraces = atoi(argv[2]);
+	if(argc > 3) dualTrace = (atoi(argv[3]) != 0);
+	if(nofSamples <= 0 || nofSamples%8 != 0 || nofTraces <= 0) {
+		std::cerr<<"number of samples has to be a positive multiple of 8, number of traces has to be positive"<<std::endl;
+		return 1;
+	}
+	// in single trace mode each word holds two samples, in dual trace mode one sample of each trace
+	int nofWords = dualTrace ? nofSamples : nofSamples/2;
+
+	std::mt19937 generator(42);
+	std::vector<uint32_t> data(static_cast<size_t>(nofWords)*nofTraces);
+	for(auto& word : data) {
+		word = generator();
+	}
+
+	// check that all versions give the same result
+	for(int trace = 0; trace < 10 && trace < nofTraces; ++trace) {
+		CaenEvent reference, scalar, vectorized;
+		UnpackPerSample(reference, data.data() + trace*nofWords, nofWords, dualTrace);
+		UnpackBulk(scalar, data.data() + trace*nofWords, nofWords, dualTrace, CaenUnpack::UnpackScalar);
+		UnpackBulk(vectorized, data.data() + trace*nofWords, nofWords, dualTrace, CaenUnpack::Unpack);
+		if(!Compare(reference, scalar, dualTrace) || !Compare(reference, vectorized, dualTrace)) {
+			std::cerr<<"mismatch between per-sample and bulk unpacking for trace "<<trace<<std::endl;
+			return 1;
+		}
+	}
+
+	auto perSample = [nofWords, dualTrace](CaenEvent& event, const uint32_t* words) { UnpackPerSample(event, words, nofWords, dualTrace); };
+	auto scalar = [nofWords, dualTrace](CaenEvent& event, const uint32_t* words) { UnpackBulk(event, words, nofWords, dualTrace, CaenUnpack::UnpackScalar); };
+	auto vectorized = [nofWords, dualTrace](CaenEvent& event, const uint32_t* words) { UnpackBulk(event, words, nofWords, dualTrace, CaenUnpack::Unpack); };
+
+	std::cout<<nofTraces<<" traces with "<<nofSamples<<" samples, "<<(dualTrace?"dual":"single")<<" trace"
+#if defined(__AVX2__)
+		<<", using AVX2"
+#elif defined(__SSE2__)
+		<<", using SSE2"
+#endif
+		<<std::endl;
+	std::cout<<"                            ns/trace  ns/sample"<<std::endl;
+	struct Result { const char* fName; double fTime; };
+	std::vector<Result> results = {
+		{ "per sample, new event",    Time(data, nofWords, true,  perSample) },
+		{ "per sample, re-used event", Time(data, nofWords, false, perSample) },
+		{ "bulk scalar, new event",   Time(data, nofWords, true,  scalar) },
+		{ "bulk scalar, re-used event", Time(data, nofWords, false, scalar) },
+		{ "bulk SIMD, new event",     Time(data, nofWords, true,  vectorized) },
+		{ "bulk SIMD, re-used event", Time(data, nofWords, false, vectorized) }
+	};
+	for(const auto& result : results) {
+		std::cout<<std::left<<std::setw(27)<<result.fName<<std::right<<std::fixed<<std::setprecision(1)
+			<<std::setw(10)<<result.fTime/nofTraces<<std::setw(11)<<std::setprecision(3)<<result.fTime/nofTraces/nofSamples<<std::endl;
+	}
+
+	return 0;
+}
@@ -1,5 +1,8 @@
 #include <iostream>
 #include <iomanip>
+#include <algorithm>
+#include <functional>
+#include <unistd.h>
 
 #include "CAENDigitizer.h"
 
@@ -14,6 +17,23 @@
 #include "TMidasEvent.h"
 
 #include "CaenEvent.hh"
+#include "CaenPipeline.hh"
+#include "CaenRawFile.hh"
+#include "CaenFlatTree.hh"
+#include "CaenRNTuple.hh"
+#include "CaenTimeSorter.hh"
+#include "CaenTimestampUnwrapper.hh"
+#include "CaenEventBuilder.hh"
+#include "CaenBuiltTree.hh"
+#include "CaenAnalysis.hh"
+
+#ifndef USE_RNTUPLE
+// placeholder so the output code doesn't need to check for RNTuple support everywhere
+class CaenRNTuple;
+#endif
+
+// number of words of raw data files that are grouped into one block for the decoding threads (and read at once if not memory-mapped)
+const size_t gWordsPerBlock = 1<<18;
 
 std::string format(const std::string& format, ...)
 {
@@ -28,215 +48,185 @@ std::string format(const std::string& format, ...)
 	return &vec[0];
 }
 
-uint32_t gBoardCounter = 0;
-
-std::vector<CaenEvent*> ParseData(char* bank, int bankSize, int debug) {
-	if(debug > 4) {
-		std::cout<<"starting to read bank "<<static_cast<void*>(bank)<<" of size "<<bankSize<<std::endl;
-	}
-	std::vector<CaenEvent*> result;
-	uint32_t* data = reinterpret_cast<uint32_t*>(bank);
-
-	int w = 0;
-	for(int board = 0; w < bankSize; ++board) {
-		if(debug > 5) {
-			std::cout<<"----------------------------------------"<<std::endl;
-			std::cout<<w<<" - 0x"<<std::hex<<std::setw(8)<<std::setfill('0')<<data[w]<<std::dec<<std::setfill(' ')<<std::endl;
-		}
-		// read board aggregate header
-		if(data[w]>>28 != 0xa) {
-			if(data[w] == 0x0) {
-				while(w < bankSize) {
-					if(data[w++] != 0x0) {
-						std::cerr<<board<<". board - failed on first word, found empty word, but not all following words were empty: "<<w-1<<" 0x"<<std::hex<<std::setw(8)<<std::setfill('0')<<data[w-1]<<std::dec<<std::setfill(' ')<<std::endl;
-						return result;
-					}
-				}
-				return result;
+// writes the hits, either as tree (flat columns or the output event of the pipeline as branch address,
+// so no copy is needed unless the events come from somewhere else, e.g. the time sorter) or as RNTuple
+class OutputSink {
+public:
+	OutputSink(TTree* tree, CaenEvent* treeEvent, CaenFlatTree* flatTree, CaenRNTuple* ntuple) : fTree(tree), fTreeEvent(treeEvent), fFlatTree(flatTree), fNTuple(ntuple) {}
+	void operator()(const CaenEvent& event) {
+		if(fFlatTree != nullptr) {
+			fFlatTree->Fill(event);
+#ifdef USE_RNTUPLE
+		} else if(fNTuple != nullptr) {
+			fNTuple->Fill(event);
+#endif
+		} else {
+			if(&event != fTreeEvent) {
+				*fTreeEvent = event;
 			}
-			std::cerr<<board<<". board - failed on first word 0x"<<std::hex<<std::setw(8)<<std::setfill('0')<<data[w]<<std::dec<<std::setfill(' ')<<", highest nibble should have been 0xa!"<<std::endl;
-			return result;
+			fTree->Fill();
 		}
-		int32_t numWordsBoard = data[w++]&0xfffffff; // this is the number of 32-bit words from this board
-		if(w - 1 + numWordsBoard > bankSize) { 
-			std::cerr<<"0 - Missing words, at word "<<w-1<<", expecting "<<numWordsBoard<<" more words for board "<<board<<" (bank size "<<bankSize<<")"<<std::endl;
-			return result;
-		}
-		uint8_t boardId = data[w]>>27; // GEO address of board (can be set via register 0xef08 for VME)
-		uint16_t pattern = (data[w]>>8) & 0x7fff; // value read from LVDS I/O (VME only)
-		uint8_t channelMask = data[w++]&0xff; // which channels are in this board aggregate
-		uint32_t boardCounter = data[w++]&0x7fffff; // ??? "counts the board aggregate"
-		uint32_t boardTime = data[w++]; // time of creation of aggregate (does not correspond to a physical quantity)
-		if(debug > 5) {
-			std::cout<<"pattern 0x"<<std::hex<<std::setw(8)<<std::setfill('0')<<pattern<<std::dec<<std::setfill(' ')<<", counter "<<boardCounter<<", time "<<boardTime<<", board ID "<<static_cast<int>(boardId)<<std::endl;
-			std::cout<<"channel mask 0x"<<std::hex<<std::setw(8)<<std::setfill('0')<<static_cast<int>(channelMask)<<std::dec<<std::setfill(' ')<<std::endl;
-		}
-		if(boardCounter < gBoardCounter) {
-			std::cerr<<"current board counter "<<boardCounter<<" is less than previous one "<<gBoardCounter<<", skipping this data"<<std::endl;
-			return result;
+	}
+	// compact hits are only used with the flat tree, or without any output tree
+	void operator()(const CaenHit& hit) {
+		if(fFlatTree != nullptr) {
+			fFlatTree->Fill(hit);
 		}
-		gBoardCounter = boardCounter;
+	}
 
-		for(uint8_t channel = 0; channel < 16; channel += 2) {
-			if(((channelMask>>(channel/2)) & 0x1) == 0x0) {
-				if(debug > 5) {
-					std::cout<<"skipping dual channel "<<static_cast<int>(channel)<<std::endl;
-				}
-				continue;
-			}
-			// read channel aggregate header
-			if(data[w]>>31 != 0x1) {
-				std::cerr<<"Failed on first word 0x"<<std::hex<<std::setw(8)<<std::setfill('0')<<data[w]<<std::dec<<std::setfill(' ')<<", highest bit should have been set!"<<std::endl;
-				return result;
-			}
-			int32_t numWords = data[w++]&0x3fffff;//per channel
-			if(debug > 6) {
-				std::cout<<w<<" - 0x"<<std::hex<<std::setw(8)<<std::setfill('0')<<data[w]<<std::dec<<std::setfill(' ')<<std::endl;
-			}
-			if(w >= bankSize) {
-				std::cerr<<"1 - Missing words, got only "<<w-1<<" words for channel "<<channel<<" (bank size "<<bankSize<<")"<<std::endl;
-				return result;
-			}
-			if(((data[w]>>29) & 0x3) != 0x3) {
-				std::cerr<<"Failed on second word 0x"<<std::hex<<std::setw(8)<<std::setfill('0')<<data[w]<<std::dec<<std::setfill(' ')<<", bits 29 and 30 should have been set!"<<std::endl;
-				return result;
-			}
-			bool dualTrace = ((data[w]>>31) == 0x1);
-			bool extras    = (((data[w]>>28) & 0x1) == 0x1);
-			bool waveform  = (((data[w]>>27) & 0x1) == 0x1);
-			uint8_t extraFormat = ((data[w]>>24) & 0x7);
-			//for now we ignore the information which traces are stored:
-			//bits 22,23: if(dualTrace) 00 = "Input and baseline", 01 = "CFD and Baseline", 10 = "Input and CFD"
-			//            else          00 = "Input", 01 = "CFD"
-			//bits 19,20,21: 000 = "Long gate",  001 = "over thres.", 010 = "shaped TRG", 011 = "TRG Val. Accept. Win.", 100 = "Pile Up", 101 = "Coincidence", 110 = reserved, 111 = "Trigger"
-			//bits 16,17,18: 000 = "Short gate", 001 = "over thres.", 010 = "TRG valid.", 011 = "TRG HoldOff",           100 = "Pile Up", 101 = "Coincidence", 110 = reserved, 111 = "Trigger"
-			int numSampleWords = 4*(data[w++]&0xffff);// this is actually the number of samples divided by eight, 2 sample per word => 4*
-			if(w >= bankSize) {
-				std::cerr<<"2 - Missing words, got only "<<w-1<<" words for channel "<<channel<<" (bank size "<<bankSize<<")"<<std::endl;
-				return result;
-			}
-			int eventSize = numSampleWords+2; // +2 = trigger time words and charge word
-			if(extras) ++eventSize;
-			if(debug > 5) {
-				std::cout<<"supposed to have "<<numWords<<" words in this channel, "<<(waveform?"w/":"w/o")<<" waveform(s), "<<(dualTrace?"w/":"w/o")<<" dual trace, "<<(extras?"w/":"w/o")<<" extras in format "<<static_cast<uint16_t>(extraFormat)<<", with "<<numSampleWords<<" sample words, at word "<<w<<"/"<<bankSize<<", event size "<<eventSize<<" => "<<(numWords-2)/eventSize<<" events"<<std::endl;
-			}
-			if(numWords%eventSize != 2) {
-				std::cerr<<numWords<<" words in channel aggregate, event size is "<<eventSize<<" => "<<static_cast<double>(numWords-2.)/static_cast<double>(eventSize)<<" events?"<<std::endl;
-				return result;
-			}
+private:
+	TTree* fTree;
+	CaenEvent* fTreeEvent;
+	CaenFlatTree* fFlatTree;
+	CaenRNTuple* fNTuple;
+};
+
+template<typename Hit>
+void PrintSorterStatistics(const CaenTimeSorter<Hit>& sorter)
+{
+	std::cout<<"time sorting buffered at most "<<sorter.MaxBuffered()<<" hits"<<std::endl;
+	if(sorter.NofLate() > 0) {
+		std::cerr<<sorter.NofLate()<<" hits arrived after the sorting window and are out of order, use a larger window"<<std::endl;
+	}
+}
+
+void Usage(const char* name)
+{
+	std::cerr<<"Usage: "<<name<<" [options] <input midas file> <output root file> <optional debug level>"<<std::endl
+		<<"options:"<<std::endl
+		<<"  -j <number>  number of decoding threads (default 1)"<<std::endl
+		<<"  -s           read raw data files in chunks instead of memory-mapping them"<<std::endl
+		<<"  -o <format>  output format: event (CaenEvent objects, default), flat (one branch per quantity),"<<std::endl
+		<<"               hits (like flat, but without waveforms, which aren't decoded at all), rntuple,"<<std::endl
+		<<"               or none (only the histograms, only the channels they use are decoded)"<<std::endl
+		<<"  -P <bytes>   approximate page size of the RNTuple output"<<std::endl
+		<<"  -Z <setting> ROOT compression setting of the output file (e.g. 505 for zstd level 5)"<<std::endl
+		<<"  -W           skip the waveforms, only the scalar quantities are decoded"<<std::endl
+		<<"  -D           skip the digital probes of the waveforms"<<std::endl
+		<<"  -m <mask>    only decode channels in this mask (e.g. 0x3 for channels 0 and 1)"<<std::endl
+		<<"  -t <ns>      write the hits in time order, sorted within this lookahead window"<<std::endl
+		<<"  -b <ns>      write built events of all hits within this coincidence window instead of single hits"<<std::endl
+		<<"               (hits are time sorted with the window of -t, default 10000 ns, waveforms aren't decoded)"<<std::endl
+		<<"  -T <channel> only keep built events with a hit in this trigger channel"<<std::endl
+		<<"  -M <number>  only keep built events with at least this many hits (default 1)"<<std::endl
+		<<"  -c <file>    analysis config file with the histogram stages (default channels and channelVsCharge),"<<std::endl
+		<<"               stages that need time-ordered hits sort them with the window of -t, default 10000 ns"<<std::endl;
+}
 
-			// read channel data
-			for(int ev = 0; ev < (numWords-2)/eventSize; ++ev) { // -2 = 2 header words for channel aggregate
-				if(debug > 6) {
-					std::cout<<"--------------------"<<std::endl;
-					std::cout<<w<<" - 0x"<<std::hex<<std::setw(8)<<std::setfill('0')<<data[w]<<std::dec<<std::setfill(' ')<<std::endl;
+int main(int argc, char** argv) {
+	const char* name = argv[0];
+	int nofThreads = 1;
+	bool chunkedInput = false;
+	std::string outputFormat = "event";
+	size_t pageSize = 0;
+	int compression = -1;
+	CaenDecoder::Options decoderOptions;
+	double sortWindow = 0.;
+	double buildWindow = 0.;
+	int triggerChannel = -1;
+	int minMultiplicity = 1;
+	std::string analysisConfig;
+	int opt;
+	while((opt = getopt(argc, argv, "j:so:P:Z:WDm:t:b:T:M:c:")) != -1) {
+		switch(opt) {
+			case 'j':
+				nofThreads = strtol(optarg, nullptr, 0);
+				if(nofThreads < 1) {
+					std::cerr<<"number of threads has to be at least one, not "<<optarg<<std::endl;
+					return 1;
 				}
-				auto event = new CaenEvent;
-				event->Channel(channel + (data[w]>>31)); // highest bit indicates odd channel
-				event->TriggerTime(data[w++] & 0x7fffffff);
-				if(waveform) {
-					if(w + numSampleWords >= bankSize) { // need to read at least the sample words plus the charge/extra word
-						std::cerr<<"3 - Missing "<<numSampleWords<<" waveform words, got only "<<w-1<<" words for channel "<<channel<<" (bank size "<<bankSize<<")"<<std::endl;
-						return result;
-					}
-					for(int s = 0; s < numSampleWords && w < bankSize; ++s, ++w) {
-						if(debug > 7) {
-							std::cout<<w<<" - 0x"<<std::hex<<std::setw(8)<<std::setfill('0')<<data[w]<<std::dec<<std::setfill(' ')<<std::endl;
-						}
-						event->AddDigitalWaveformSample(0, (data[w]>>14)&0x1);
-						event->AddDigitalWaveformSample(1, (data[w]>>15)&0x1);
-						if(dualTrace) {
-							// all even samples are from the first trace, all odd ones from the second trace
-							event->AddWaveformSample(1, data[w]&0x3fff);
-							event->AddWaveformSample(0, (data[w]>>16)&0x3fff);
-						} else {
-							// both samples are from the first trace
-							event->AddWaveformSample(0, data[w]&0x3fff);
-							event->AddWaveformSample(0, (data[w]>>16)&0x3fff);
-						}
-						event->AddDigitalWaveformSample(0, (data[w]>>30)&0x1);
-						event->AddDigitalWaveformSample(1, (data[w]>>31)&0x1);
-					}
-				} else {
-					if(w >= bankSize) { // need to read at least the sample words plus the charge/extra word
-						std::cerr<<"3 - Missing words, got only "<<w-1<<" words for channel "<<channel<<" (bank size "<<bankSize<<")"<<std::endl;
-						return result;
-					}
+				break;
+			case 's':
+				chunkedInput = true;
+				break;
+			case 'o':
+				outputFormat = optarg;
+				if(outputFormat != "event" && outputFormat != "flat" && outputFormat != "hits" && outputFormat != "rntuple" && outputFormat != "none") {
+					std::cerr<<"unknown output format "<<optarg<<std::endl;
+					Usage(name);
+					return 1;
+				}
+#ifndef USE_RNTUPLE
+				if(outputFormat == "rntuple") {
+					std::cerr<<"RNTuple output is not available, re-compile with 'make RNTUPLE=1'"<<std::endl;
+					return 1;
 				}
-				if(extras) {
-					if(debug > 6) {
-						std::cout<<w<<" - 0x"<<std::hex<<std::setw(8)<<std::setfill('0')<<data[w]<<std::dec<<std::setfill(' ')<<std::endl;
-					}
-					switch(extraFormat) {
-						case 0: // [31:16] extended time stamp, [15:0] baseline*4
-							//event->Baseline(data[w]&0xffff);
-							event->ExtendedTimestamp(data[w++]>>16);
-							break;
-						case 1: // [31:16] extended time stamp, 15 trigger lost, 14 over range, 13 1024 triggers, 12 n lost triggers
-							event->NLostCount(((data[w]>>12)&0x1) == 0x1);
-							event->KiloCount(((data[w]>>13)&0x1) == 0x1);
-							event->OverRange(((data[w]>>14)&0x1) == 0x1);
-							event->LostTrigger(((data[w]>>15)&0x1) == 0x1);
-							event->ExtendedTimestamp(data[w++]>>16);
-							break;
-						case 2: // [31:16] extended time stamp,  15 trigger lost, 14 over range, 13 1024 triggers, 12 n lost triggers, [9:0] fine time stamp
-							event->Cfd(data[w]&0x3ff);
-							event->NLostCount(((data[w]>>12)&0x1) == 0x1);
-							event->KiloCount(((data[w]>>13)&0x1) == 0x1);
-							event->OverRange(((data[w]>>14)&0x1) == 0x1);
-							event->LostTrigger(((data[w]>>15)&0x1) == 0x1);
-							event->ExtendedTimestamp(data[w++]>>16);
-							break;
-						case 4: // [31:16] lost trigger counter, [15:0] total trigger counter
-							//event->LostTriggerCount(data[w]&0xffff);
-							//event->TotalTriggerCount(data[w++]>>16);
-							break;
-						case 5: // [31:16] CFD sample after zero cross., [15:0] CFD sample before zero cross.
-							//event->CfdAfterZC(data[w]&0xffff);
-							//event->CfdBeforeZC(data[w++]>>16);
-							break;
-						case 7: // fixed value of 0x12345678
-							if(data[w++] != 0x12345678) {
-								std::cerr<<"Failed to get debug data word 0x12345678, got "<<std::hex<<std::setw(8)<<std::setfill('0')<<data[w]<<std::dec<<std::setfill(' ')<<std::endl;
-								break;
-							}
-							break;
-						default:
-							break;
-					}
+#endif
+				break;
+			case 'P':
+				pageSize = strtoul(optarg, nullptr, 0);
+				break;
+			case 'Z':
+				compression = strtol(optarg, nullptr, 0);
+				break;
+			case 'W':
+				decoderOptions.fSkipWaveforms = true;
+				break;
+			case 'D':
+				decoderOptions.fSkipDigitalProbes = true;
+				break;
+			case 'm':
+				decoderOptions.fChannelMask = strtoul(optarg, nullptr, 0);
+				break;
+			case 't':
+				sortWindow = strtod(optarg, nullptr);
+				if(sortWindow <= 0.) {
+					std::cerr<<"time sorting window has to be positive, not "<<optarg<<std::endl;
+					return 1;
 				}
-				if(debug > 6) {
-					std::cout<<w<<" - 0x"<<std::hex<<std::setw(8)<<std::setfill('0')<<data[w]<<std::dec<<std::setfill(' ')<<std::endl;
+				break;
+			case 'b':
+				buildWindow = strtod(optarg, nullptr);
+				if(buildWindow <= 0.) {
+					std::cerr<<"coincidence window has to be positive, not "<<optarg<<std::endl;
+					return 1;
 				}
-				//if(w >= bankSize) {
-				//	std::cerr<<"4 - Missing words, got only "<<w-1<<" words for channel "<<channel<<" (bank size "<<bankSize<<")"<<std::endl;
-				//}
-				event->ShortGate(data[w]&0x7fff);
-				event->OverRange((data[w]>>15) & 0x1);
-				event->Charge(data[w++]>>16);
-				result.push_back(event);
-				if(debug > 5) {
-					event->Print();
+				break;
+			case 'T':
+				triggerChannel = strtol(optarg, nullptr, 0);
+				break;
+			case 'M':
+				minMultiplicity = strtol(optarg, nullptr, 0);
+				if(minMultiplicity < 1) {
+					std::cerr<<"minimum multiplicity has to be at least 1, not "<<optarg<<std::endl;
+					return 1;
 				}
-			} // while(w < bankSize)
-		} // for(uint8_t channel = 0; channel < 16; channel += 2)
-	} // for(int board = 0; w < bankSize; ++board)
-
-	return result;
-}
-
-int main(int argc, char** argv) {
+				break;
+			case 'c':
+				analysisConfig = optarg;
+				break;
+			default:
+				Usage(name);
+				return 1;
+		}
+	}
+	if(pageSize > 0 && outputFormat != "rntuple") {
+		std::cerr<<"page size is only used for RNTuple output, ignoring it"<<std::endl;
+	}
+	if(buildWindow > 0.) {
+		if(outputFormat != "event") {
+			std::cerr<<"built events are always written as tree, ignoring output format "<<outputFormat<<std::endl;
+		}
+		outputFormat = "built";
+		if(sortWindow <= 0.) {
+			sortWindow = 10000.;
+		}
+	} else if(triggerChannel >= 0 || minMultiplicity > 1) {
+		std::cerr<<"trigger channel and multiplicity are only used when building events, ignoring them"<<std::endl;
+	}
+	// the remaining arguments are input file, output file, and optional debug level
+	argc -= optind - 1;
+	argv += optind - 1;
 	if(argc != 3 && argc != 4) {
-		std::cerr<<"Usage: "<<argv[0]<<" <input midas file> <output root file> <optional debug level>"<<std::endl;
+		Usage(name);
 		return 1;
 	}
 
 	// open input file
 	std::string fileName = argv[1];
 	TMidasFile* midasFile = nullptr;
-	std::ifstream dataFile;
+	CaenRawFile rawFile(gWordsPerBlock);
 	size_t fileSize = 0;
-	char* data = nullptr;
 	if(fileName.find(".mid") != std::string::npos) {
 		midasFile = new TMidasFile(argv[1]);
 		if(midasFile == nullptr) {
@@ -245,17 +235,12 @@ int main(int argc, char** argv) {
 		}
 		fileSize = midasFile->GetFileSize();
 	} else {
-		dataFile.open(argv[1]);
-		if(!dataFile.is_open()) {
+		// raw data files are memory-mapped (or read in chunks), so they don't need to fit into memory
+		if(!rawFile.Open(argv[1], !chunkedInput)) {
 			std::cerr<<R"(Failed to open ")"<<argv[1]<<R"(" as input data file)"<<std::endl;
 			return 1;
 		}
-		dataFile.seekg(0, dataFile.end);
-		fileSize = dataFile.tellg();
-		dataFile.seekg(0, dataFile.beg);
-		data = new char[fileSize];
-		dataFile.read(data, fileSize);
-		dataFile.close();
+		fileSize = rawFile.FileSize();
 	}
 
 	// open root file
@@ -264,6 +249,9 @@ int main(int argc, char** argv) {
 		std::cerr<<R"(Failed to open ")"<<argv[2]<<R"(" as output root file)"<<std::endl;
 		return 1;
 	}
+	if(compression >= 0) {
+		output->SetCompressionSettings(compression);
+	}
 
 	int debug = 0;
 	if(argc == 4) {
@@ -311,112 +299,211 @@ int main(int argc, char** argv) {
 		}
 	}
 
-	// create tree and histograms
-	TTree* tree = new TTree("tree", "tree");
-	auto caenEvent = new CaenEvent;
-	tree->Branch("event", &caenEvent);
-
-	auto list = new TList;
-	auto channels = new TH1F("channels", "channel number", nofChannels+1, 0, nofChannels+1); list->Add(channels);
-	auto charge = new TH2F("channelVsCharge", "channelVsCharge", 5000, 0, 50000, nofChannels+1, 0, nofChannels+1); list->Add(charge);
-
+	// create decoding pipeline, histograms, and tree
+	CaenPipeline pipeline(nofThreads, debug);
+	// with worker threads the histograms of the unordered stages are filled by them, with all hits of a segment at once,
+	// otherwise straight from the decoded hits, so the sequential pipeline doesn't have to collect them first
+	bool batch = pipeline.NofWorkers() > 0;
+	CaenAnalysis analysis(pipeline.NofBatchThreads(), nofChannels);
+	if(!analysisConfig.empty() && !analysis.ReadConfig(analysisConfig)) {
+		output->Close();
+		return 1;
+	}
 	if(debug > 0) {
-		std::cout<<std::endl<<"created histograms:"<<std::endl;
-		list->Print();
+		analysis.Print();
+	}
+	if(outputFormat == "none") {
+		// nothing is written, so the channels none of the stages use don't need to be decoded (unless the channel
+		// histograms are filled, these count the unused channels in their overflow bin)
+		decoderOptions.fChannelMask &= analysis.ChannelMask();
+	}
+	if(analysis.Ordered() && sortWindow <= 0.) {
+		sortWindow = 10000.;
 	}
+	pipeline.SetDecoderOptions(decoderOptions);
+	if(batch) {
+		pipeline.SetHitBatchOutput([&analysis](int thread, CaenSpan<CaenHit> hits, int weight) { analysis.Process(thread, hits, weight); });
+		pipeline.SetEventBatchOutput([&analysis](int thread, CaenSpan<CaenEvent> events, int weight) { analysis.Process(thread, events, weight); });
+	}
+	TTree* tree = nullptr;
+	auto caenEvent = pipeline.OutputEvent();
+	CaenFlatTree* flatTree = nullptr;
+	CaenBuiltTree* builtTree = nullptr;
+	CaenRNTuple* ntuple = nullptr;
+	if(outputFormat == "none") {
+		// histograms only
+	} else if(outputFormat == "rntuple") {
+#ifdef USE_RNTUPLE
+		ntuple = new CaenRNTuple("ntuple", *output, pageSize, compression);
+#endif
+	} else {
+		tree = new TTree("tree", "tree");
+		if(outputFormat == "built") {
+			builtTree = new CaenBuiltTree(tree);
+		} else if(outputFormat == "flat" || outputFormat == "hits") {
+			flatTree = new CaenFlatTree(tree, outputFormat == "flat");
+		} else {
+			tree->Branch("event", &caenEvent);
+		}
+	}
+
+	OutputSink outputSink(tree, caenEvent, flatTree, ntuple);
 
-	// read events from midas file
+	// readers that fill a block with the next data, MIDAS banks are copied as the event is re-used for the next read
+	std::function<bool(CaenPipeline::Block&)> reader;
 	auto event = std::make_shared<TMidasEvent>();
-	char* bank = nullptr;
-	int bankSize;
-	
+	int i = 0;
 	if(midasFile != nullptr) {
-		int i = 0;
-		while(true) {
-			if(debug > 3) {
-				std::cout<<"trying to read "<<i<<". midas event, read "<<midasFile->GetBytesRead()<<" bytes out of "<<fileSize<<" bytes so far"<<std::endl;
-			}
-			if(midasFile->Read(event) <= 0) {
-				break;
-			}
-			switch(event->GetEventId()) {
-				case 1:
-					event->SetBankList();
-					if(debug > 6) {
-						event->Print("a");
-					}
-					bankSize = event->LocateBank(nullptr, "CAEN", reinterpret_cast<void**>(&bank));
-					if(bankSize > 0) {
-						std::vector<CaenEvent*> caenEvents = ParseData(bank, bankSize, debug);
-						if(debug > 3) {
-							std::cout<<"got "<<caenEvents.size()<<" events from this midas event"<<std::endl;
-						}
-						for(auto ev : caenEvents) {
-							*caenEvent = *ev;
-							tree->Fill();
-							channels->Fill(ev->Channel());
-							charge->Fill(ev->Charge(), ev->Channel());
-							if(debug > 4) {
-								std::cout<<"Charge "<<caenEvent->Charge()<<std::endl;
-							}
-							delete ev;
+		reader = [&](CaenPipeline::Block& block) {
+			char* bank = nullptr;
+			while(true) {
+				if(debug > 3) {
+					std::cout<<"trying to read "<<i<<". midas event, read "<<midasFile->GetBytesRead()<<" bytes out of "<<fileSize<<" bytes so far"<<std::endl;
+				}
+				if(midasFile->Read(event) <= 0) {
+					return false;
+				}
+				int bankSize = 0;
+				switch(event->GetEventId()) {
+					case 1:
+						event->SetBankList();
+						if(debug > 6) {
+							event->Print("a");
 						}
-						if(debug > 3) {
-							std::cout<<"have "<<tree->GetEntries()<<" entries total"<<std::endl;
+						bankSize = event->LocateBank(nullptr, "CAEN", reinterpret_cast<void**>(&bank));
+						if(bankSize > 0) {
+							block.fBuffer.assign(reinterpret_cast<uint32_t*>(bank), reinterpret_cast<uint32_t*>(bank) + bankSize);
+							block.fData = block.fBuffer.data();
+							block.AddSegment(0, bankSize);
 						}
-					}
-					break;
-				case 0x8000:
-					std::cout<<std::endl<<"begin of run event"<<std::endl;
-					break;
-				case 0x8001:
-					std::cout<<midasFile->GetBytesRead()/1024<<" kiB/"<<fileSize/1024<<" kiB = "<<(100*midasFile->GetBytesRead())/fileSize<<" % done"<<std::endl
-						<<"end of run event"<<std::endl;
-					break;
-				default:
-					std::cout<<std::endl<<"unknown event id 0x"<<std::hex<<event->GetEventId()<<std::dec<<std::endl;
-					break;
-			}
-			if(i%10 == 0) {
-				std::cout<<midasFile->GetBytesRead()/1024<<" kiB/"<<fileSize/1024<<" kiB = "<<(100*midasFile->GetBytesRead())/fileSize<<" % done\r"<<std::flush;
+						break;
+					case 0x8000:
+						std::cout<<std::endl<<"begin of run event"<<std::endl;
+						break;
+					case 0x8001:
+						std::cout<<midasFile->GetBytesRead()/1024<<" kiB/"<<fileSize/1024<<" kiB = "<<(100*midasFile->GetBytesRead())/fileSize<<" % done"<<std::endl
+							<<"end of run event"<<std::endl;
+						break;
+					default:
+						std::cout<<std::endl<<"unknown event id 0x"<<std::hex<<event->GetEventId()<<std::dec<<std::endl;
+						break;
+				}
+				if(i%10 == 0) {
+					std::cout<<midasFile->GetBytesRead()/1024<<" kiB/"<<fileSize/1024<<" kiB = "<<(100*midasFile->GetBytesRead())/fileSize<<" % done\r"<<std::flush;
+				}
+				++i;
+				if(bankSize > 0) {
+					return true;
+				}
 			}
-			++i;
-		} // end of event loop
-		midasFile->Close();
+		};
 	} else {
-		// read from data buffer
-		uint32_t* word = reinterpret_cast<uint32_t*>(data);
-		size_t pos = 0;
-		int i = 0;
-		while(pos < fileSize/4) {
-			// check that we have the next header, otherwise advance until we find it
-			while((word[pos]>>28) != 0xa) {
-				std::cout<<"0x"<<std::hex<<word[pos]<<std::dec<<": not a header, skipping"<<std::endl;
-				++pos;
-			}
-			// read data size (in 32-bit words) from header
-			int32_t numWords = word[pos]&0xfffffff;
-			std::vector<CaenEvent*> caenEvents = ParseData(reinterpret_cast<char*>(word + pos), numWords, debug);
-			if(debug > 3) {
-				std::cout<<"got "<<caenEvents.size()<<" events from this midas event"<<std::endl;
+		// read from raw data file, each board aggregate is decoded on its own, several of them are grouped into one block
+		reader = [&](CaenPipeline::Block& block) {
+			if(!rawFile.Read(block)) {
+				return false;
 			}
-			for(auto ev : caenEvents) {
-				*caenEvent = *ev;
-				tree->Fill();
-				channels->Fill(ev->Channel());
-				charge->Fill(ev->Charge(), ev->Channel());
-			}
-			pos += numWords;
 			if(i%10 == 0) {
-				// pos count in 32bit = 4 bytes words; *4/1024 = /256
-				std::cout<<pos/256<<" kiB/"<<fileSize/1024<<" kiB = "<<(400.*pos)/fileSize<<" % done\r"<<std::flush;
+				std::cout<<rawFile.BytesRead()/1024<<" kiB/"<<fileSize/1024<<" kiB = "<<(100.*rawFile.BytesRead())/fileSize<<" % done\r"<<std::flush;
 			}
 			++i;
-		} // end of event loop
-		std::cout<<pos/256<<" kiB/"<<fileSize/1024<<" kiB = "<<(400.*pos)/fileSize<<" % done"<<std::endl;
+			return true;
+		};
+	}
+
+	// the hits are either written straight away or go through the time sorter first
+	auto hitSink = [&](const CaenHit& hit) {
+		outputSink(hit);
+		if(debug > 4) {
+			std::cout<<"Charge "<<hit.Charge()<<std::endl;
+		}
+	};
+	auto eventSink = [&](const CaenEvent& ev) {
+		outputSink(ev);
+		if(debug > 4) {
+			std::cout<<"Charge "<<ev.Charge()<<std::endl;
+		}
+	};
+	auto decodedHit = [&](const CaenHit& hit) {
+		if(!batch) analysis.Process(0, CaenSpan<CaenHit>(&hit, 1), 1);
+	};
+	auto decodedEvent = [&](const CaenEvent& ev) {
+		if(!batch) {
+			CaenHit hit = ev.Hit();
+			analysis.Process(0, CaenSpan<CaenHit>(&hit, 1), 1);
+		}
+	};
+	// sorting and event building use the unwrapped times, so they don't break when the timestamps roll over
+	CaenTimestampUnwrapper unwrapper;
+	if(outputFormat == "built") {
+		// the tree only gets the accepted built events
+		CaenTimeSorter<CaenHit> sorter(sortWindow);
+		CaenEventBuilder builder(buildWindow, triggerChannel, minMultiplicity);
+		auto builtSink = [&](const std::vector<CaenHit>& hits) { builtTree->Fill(hits); };
+		auto sortedSink = [&](const CaenHit& hit, uint64_t time) {
+			if(analysis.Ordered()) analysis.AddOrdered(hit, time);
+			builder.Add(hit, time, builtSink);
+		};
+		pipeline.Run(reader, [&](const CaenHit& hit) { decodedHit(hit); sorter.Add(hit, unwrapper.Unwrap(hit), sortedSink); });
+		sorter.Flush(sortedSink);
+		builder.Flush(builtSink);
+		PrintSorterStatistics(sorter);
+		std::cout<<"built "<<builder.NofBuilt()<<" events, rejected "<<builder.NofRejected()<<std::endl;
+	} else if(outputFormat == "hits" || outputFormat == "none") {
+		// list mode, no need to decode the waveforms
+		if(sortWindow > 0.) {
+			CaenTimeSorter<CaenHit> sorter(sortWindow);
+			auto sortedSink = [&](const CaenHit& hit, uint64_t time) {
+				if(analysis.Ordered()) analysis.AddOrdered(hit, time);
+				hitSink(hit);
+			};
+			pipeline.Run(reader, [&](const CaenHit& hit) { decodedHit(hit); sorter.Add(hit, unwrapper.Unwrap(hit), sortedSink); });
+			sorter.Flush(sortedSink);
+			PrintSorterStatistics(sorter);
+		} else {
+			pipeline.Run(reader, [&](const CaenHit& hit) { decodedHit(hit); hitSink(hit); });
+		}
+	} else {
+		if(sortWindow > 0.) {
+			CaenTimeSorter<CaenEvent> sorter(sortWindow);
+			auto sortedSink = [&](const CaenEvent& ev, uint64_t time) {
+				if(analysis.Ordered()) analysis.AddOrdered(ev.Hit(), time);
+				eventSink(ev);
+			};
+			pipeline.Run(reader, [&](const CaenEvent& ev) { decodedEvent(ev); sorter.Add(ev, unwrapper.Unwrap(ev), sortedSink); });
+			sorter.Flush(sortedSink);
+			PrintSorterStatistics(sorter);
+		} else {
+			pipeline.Run(reader, [&](const CaenEvent& ev) { decodedEvent(ev); eventSink(ev); });
+		}
 	}
 
-	tree->Write();
+	analysis.Flush();
+	if(unwrapper.NofRollovers() > 0) {
+		std::cout<<"timestamps rolled over "<<unwrapper.NofRollovers()<<" times"<<std::endl;
+	}
+
+	if(midasFile != nullptr) {
+		midasFile->Close();
+	} else {
+		std::cout<<rawFile.BytesRead()/1024<<" kiB/"<<fileSize/1024<<" kiB = "<<(100.*rawFile.BytesRead())/fileSize<<" % done"<<std::endl;
+		rawFile.Close();
+	}
+
+	if(tree != nullptr) {
+		tree->Write();
+	}
+#ifdef USE_RNTUPLE
+	if(ntuple != nullptr) {
+		ntuple->Close();
+	}
+#endif
+	auto list = new TList;
+	analysis.AddTo(list);
+	if(debug > 0) {
+		std::cout<<std::endl<<"histograms:"<<std::endl;
+		list->Print();
+	}
 	list->Write();
 	output->Close();
 
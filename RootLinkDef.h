@@ -1,2 +1,4 @@
 #pragma link C++ class CaenSettings+;
 #pragma link C++ class CaenEvent+;
+// up to version 2 the waveforms were stored as one vector per trace
+#pragma read sourceClass="CaenEvent" targetClass="CaenEvent" version="[-2]" source="std::vector<std::vector<unsigned short> > fWaveforms; std::vector<std::vector<unsigned char> > fDigitalWaveforms" target="fSamples, fDigitalSamples, fNofWaveforms, fNofDigitalWaveforms, fWaveformOffset, fDigitalWaveformOffset" code="{ newObj->SetWaveforms(onfile.fWaveforms, onfile.fDigitalWaveforms); }"
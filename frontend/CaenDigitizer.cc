@@ -10,6 +10,8 @@
 #include <cstdarg>
 #include <cstring>
 #include <cstdlib>
+#include <chrono>
+#include <algorithm>
 
 std::string format(const std::string& format, ...)
 {
@@ -24,8 +26,13 @@ std::string format(const std::string& format, ...)
 	return &vec[0];
 }
 
+double Milliseconds(const std::chrono::steady_clock::time_point& start)
+{
+	return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
 CaenDigitizer::CaenDigitizer(HNDLE hDB, bool debug)
-	: fSettings(new CaenSettings(debug)), fDebug(debug)
+	: fOdb(hDB), fSettings(new CaenSettings(debug)), fReadoutRunning(false), fRawWriter(NULL), fMaxEventSize(0), fLastStatisticsUpdate(0), fLastBytesWritten(0), fDebug(debug)
 {
 	fSettings->ReadOdb(hDB);
 	Setup();
@@ -34,9 +41,6 @@ CaenDigitizer::CaenDigitizer(HNDLE hDB, bool debug)
 void CaenDigitizer::Setup()
 {
 	if(fDebug) std::cout<<"setting up digitizer"<<std::endl;
-	CAEN_DGTZ_ErrorCode errorCode;
-	CAEN_DGTZ_BoardInfo_t boardInfo;
-	int majorNumber;
 
 	if(static_cast<int>(fHandle.size()) < fSettings->NumberOfBoards()) {
 		// we have more boards now than before, so we need to initialize the additional boards
@@ -44,78 +48,205 @@ void CaenDigitizer::Setup()
 			fHandle.resize(fSettings->NumberOfBoards(), -1);
 			fBuffer.resize(fSettings->NumberOfBoards(), NULL);
 			fBufferSize.resize(fSettings->NumberOfBoards(), 0);
+			fReadoutBufferSize.resize(fSettings->NumberOfBoards(), 0);
+			fEventReady.resize(fSettings->NumberOfBoards(), false);
 			fWaveforms.resize(fSettings->NumberOfBoards(), NULL);
+			fRingBuffer.resize(fSettings->NumberOfBoards(), NULL);
+			fBlockPending.resize(fSettings->NumberOfBoards(), false);
+			fBlockOffset.resize(fSettings->NumberOfBoards(), 0);
+			fSetupTime.resize(fSettings->NumberOfBoards(), SetupTime());
+			fRegisters.resize(fSettings->NumberOfBoards());
 		} catch(std::exception e) {
 			std::cerr<<"Failed to resize vectors for "<<fSettings->NumberOfBoards()<<" boards, and "<<fSettings->NumberOfChannels()<<" channels: "<<e.what()<<std::endl;
 			throw e;
 		}
-		for(int b = 0; b < fSettings->NumberOfBoards(); ++b) {
-			if(fHandle[b] == -1) {
-				if(fDebug) std::cout<<"setting up board "<<b<<std::endl;
-				// open digitizers
-				errorCode = CAEN_DGTZ_OpenDigitizer(fSettings->LinkType(b), fSettings->PortNumber(b), fSettings->DeviceNumber(b), fSettings->VmeBaseAddress(b), &fHandle[b]);
-				if(errorCode != 0) {
-					throw std::runtime_error(format("Error %d when opening digitizer", errorCode));
-				}
-				if(fDebug) std::cout<<"got handle "<<fHandle[b]<<" for board "<<b<<std::endl;
-				// get digitizer info
-				errorCode = CAEN_DGTZ_GetInfo(fHandle[b], &boardInfo);
-				if(errorCode != 0) {
-					CAEN_DGTZ_CloseDigitizer(fHandle[b]);
-					throw std::runtime_error(format("Error %d when reading digitizer info", errorCode));
-				}
+	}
+	// DataReady can be called before the first run (mfe times the polling at startup), so this can't wait for StartReadoutThreads
+	// (atomics can't be moved, so the vector is replaced instead of resized, the threads are never running here)
+	if(static_cast<int>(fReadoutError.size()) != fSettings->NumberOfBoards()) {
+		fReadoutError = std::vector<std::atomic<int> >(fSettings->NumberOfBoards());
+		fIrqPending = std::vector<std::atomic<bool> >(fSettings->NumberOfBoards());
+	}
+
+	// the boards don't depend on each other, so they can be opened and programmed at the same time
+	// we always re-program the digitizer in case settings have been changed
+	ForEachBoard([this](int b) { SetupBoard(b); }, "setup");
+}
+
+void CaenDigitizer::SetupBoard(int b)
+{
+	CAEN_DGTZ_ErrorCode errorCode;
+	CAEN_DGTZ_BoardInfo_t boardInfo;
+	int majorNumber;
+
+	auto start = std::chrono::steady_clock::now();
+	fSetupTime[b].fOpen = 0.;
+	if(fHandle[b] == -1) {
+		if(fDebug) std::cout<<"setting up board "<<b<<std::endl;
+		// a (re-)opened board needs to be programmed from scratch
+		fSettings->ForgetProgrammed(b);
+		// open digitizers
+		errorCode = CAEN_DGTZ_OpenDigitizer(fSettings->LinkType(b), fSettings->PortNumber(b), fSettings->DeviceNumber(b), fSettings->VmeBaseAddress(b), &fHandle[b]);
+		if(errorCode != 0) {
+			fHandle[b] = -1;
+			throw std::runtime_error(format("Error %d when opening digitizer", errorCode));
+		}
+		if(fDebug) std::cout<<"got handle "<<fHandle[b]<<" for board "<<b<<std::endl;
+		fRegisters[b].Handle(fHandle[b]);
+		// get digitizer info
+		errorCode = CAEN_DGTZ_GetInfo(fHandle[b], &boardInfo);
+		if(errorCode != 0) {
+			CAEN_DGTZ_CloseDigitizer(fHandle[b]);
+			fHandle[b] = -1;
+			throw std::runtime_error(format("Error %d when reading digitizer info", errorCode));
+		}
 #ifdef USE_CURSES
-				printw("\nConnected to CAEN Digitizer Model %s as %d. board\n", boardInfo.ModelName, b);
-				printw("\nFirmware is ROC %s, AMC %s\n", boardInfo.ROC_FirmwareRel, boardInfo.AMC_FirmwareRel);
+		printw("\nConnected to CAEN Digitizer Model %s as %d. board\n", boardInfo.ModelName, b);
+		printw("\nFirmware is ROC %s, AMC %s\n", boardInfo.ROC_FirmwareRel, boardInfo.AMC_FirmwareRel);
 #else
-				std::cout<<std::endl<<"Connected to CAEN Digitizer Model "<<boardInfo.ModelName<<" as "<<b<<". board"<<std::endl;
-				std::cout<<std::endl<<"Firmware is ROC "<<boardInfo.ROC_FirmwareRel<<", AMC "<<boardInfo.AMC_FirmwareRel<<std::endl;
+		std::cout<<std::endl<<"Connected to CAEN Digitizer Model "<<boardInfo.ModelName<<" as "<<b<<". board"<<std::endl;
+		std::cout<<std::endl<<"Firmware is ROC "<<boardInfo.ROC_FirmwareRel<<", AMC "<<boardInfo.AMC_FirmwareRel<<std::endl;
 #endif
 
-				std::stringstream str(boardInfo.AMC_FirmwareRel);
-				str>>majorNumber;
-				if(majorNumber != 131 && majorNumber != 132 && majorNumber != 136) {
-					CAEN_DGTZ_CloseDigitizer(fHandle[b]);
-					throw std::runtime_error("This digitizer has no DPP-PSD firmware");
-				}
-			} // if(fHandle[b] == -1)
+		std::stringstream str(boardInfo.AMC_FirmwareRel);
+		str>>majorNumber;
+		if(majorNumber != 131 && majorNumber != 132 && majorNumber != 136) {
+			CAEN_DGTZ_CloseDigitizer(fHandle[b]);
+			fHandle[b] = -1;
+			throw std::runtime_error("This digitizer has no DPP-PSD firmware");
 		}
-	} // if(fHandle.size() < fSettings->NumberOfBoards)
+		fSetupTime[b].fOpen = Milliseconds(start);
+	} // if(fHandle[b] == -1)
 
-	// we always re-program the digitizer in case settings have been changed
-	for(int b = 0; b < fSettings->NumberOfBoards(); ++b) {
-		ProgramDigitizer(b);
-
-		// we don't really need to know how many bytes have been allocated, so we use fBufferSize here
-		free(fBuffer[b]);
-		//fBuffer[b] = static_cast<char*>(malloc(100*6504464));
-		//1638416 bytes are allocated by CAEN_DGTZ_MallocReadoutBuffer (2 channels, 192 samples each)
-		//changing this to 8 channels changed the number to 6504464
-		if(fDebug) std::cout<<fHandle[b]<<"/"<<fBuffer.size()<<": trying to allocate memory for readout buffer "<<static_cast<void*>(fBuffer[b])<<std::endl;
-		errorCode = CAEN_DGTZ_MallocReadoutBuffer(fHandle[b], &fBuffer[b], &fBufferSize[b]);
-		if(errorCode != 0) {
+	start = std::chrono::steady_clock::now();
+	ProgramDigitizer(b);
+	fSetupTime[b].fProgram = Milliseconds(start);
+
+	start = std::chrono::steady_clock::now();
+	// we don't really need to know how many bytes have been allocated, so we use fBufferSize here
+	free(fBuffer[b]);
+	//fBuffer[b] = static_cast<char*>(malloc(100*6504464));
+	//1638416 bytes are allocated by CAEN_DGTZ_MallocReadoutBuffer (2 channels, 192 samples each)
+	//changing this to 8 channels changed the number to 6504464
+	if(fDebug) std::cout<<fHandle[b]<<"/"<<fBuffer.size()<<": trying to allocate memory for readout buffer "<<static_cast<void*>(fBuffer[b])<<std::endl;
+	errorCode = CAEN_DGTZ_MallocReadoutBuffer(fHandle[b], &fBuffer[b], &fBufferSize[b]);
+	if(errorCode != 0) {
+		CAEN_DGTZ_CloseDigitizer(fHandle[b]);
+		fHandle[b] = -1;
+		throw std::runtime_error(format("Error %d when allocating readout buffer", errorCode));
+	}
+	fReadoutBufferSize[b] = fBufferSize[b];
+	if(fDebug) std::cout<<"allocated "<<fBufferSize[b]<<" bytes of buffer for board "<<b<<std::endl;
+	if(fSettings->ThreadedReadout()) {
+		// each slot of the ring buffer needs to be able to hold a full readout, i.e. as much as the readout buffer
+		delete fRingBuffer[b];
+		try {
+			fRingBuffer[b] = new CaenRingBuffer(fSettings->RingBufferSlots(), fBufferSize[b]);
+		} catch(std::exception& e) {
+			fRingBuffer[b] = NULL;
 			CAEN_DGTZ_CloseDigitizer(fHandle[b]);
-			throw std::runtime_error(format("Error %d when allocating readout buffer", errorCode));
+			fHandle[b] = -1;
+			throw std::runtime_error(format("Failed to allocate %d ring buffer slots of %d bytes: %s", fSettings->RingBufferSlots(), fBufferSize[b], e.what()));
 		}
-		if(fDebug) std::cout<<"allocated "<<fBufferSize[0]<<" bytes of buffer for board "<<b<<std::endl;
+		if(fDebug) std::cout<<"allocated "<<fSettings->RingBufferSlots()<<" ring buffer slots for board "<<b<<std::endl;
+	}
 #ifdef USE_WAVEFORMS
-		// allocate waveforms, again not caring how many bytes have been allocated
-		uint32_t size;
-		free(fWaveforms[b]);
-		errorCode = CAEN_DGTZ_MallocDPPWaveforms(fHandle[b], reinterpret_cast<void**>(&(fWaveforms[b])), &size);
-		if(errorCode != 0) {
-			CAEN_DGTZ_CloseDigitizer(fHandle[b]);
-			throw std::runtime_error(format("Error %d when allocating DPP waveforms", errorCode));
-		}
+	// allocate waveforms, again not caring how many bytes have been allocated
+	uint32_t size;
+	free(fWaveforms[b]);
+	errorCode = CAEN_DGTZ_MallocDPPWaveforms(fHandle[b], reinterpret_cast<void**>(&(fWaveforms[b])), &size);
+	if(errorCode != 0) {
+		CAEN_DGTZ_CloseDigitizer(fHandle[b]);
+		fHandle[b] = -1;
+		throw std::runtime_error(format("Error %d when allocating DPP waveforms", errorCode));
+	}
 #endif
-		if(fDebug) std::cout<<"done with board "<<b<<std::endl;
-	} // for(int b = 0; b < fSettings->NumberOfBoards(); ++b)
+	fSetupTime[b].fAllocate = Milliseconds(start);
+	if(fDebug) std::cout<<"done with board "<<b<<std::endl;
+}
+
+void CaenDigitizer::ForEachBoard(const std::function<void(int)>& func, const char* step)
+{
+	// runs func for each board, in parallel (one thread per board) if parallel setup is enabled
+	// errors are collected per board and reported together once all boards are done,
+	// so one failing board doesn't leave the others half-way through their setup
+	std::vector<std::string> errors(fSettings->NumberOfBoards());
+	auto run = [&func, &errors](int b) {
+		try {
+			func(b);
+		} catch(std::exception& e) {
+			errors[b] = e.what();
+		}
+	};
+	auto start = std::chrono::steady_clock::now();
+	if(fSettings->ParallelSetup() && fSettings->NumberOfBoards() > 1) {
+		std::vector<std::thread> threads;
+		for(int b = 0; b < fSettings->NumberOfBoards(); ++b) {
+			threads.emplace_back(run, b);
+		}
+		for(auto& thread : threads) {
+			thread.join();
+		}
+	} else {
+		for(int b = 0; b < fSettings->NumberOfBoards(); ++b) {
+			run(b);
+		}
+	}
+	double elapsed = Milliseconds(start);
+	UpdateSetupStatistics(step, elapsed);
+
+	std::string message;
+	for(int b = 0; b < fSettings->NumberOfBoards(); ++b) {
+		if(errors[b].empty()) continue;
+		std::cerr<<"Board "<<b<<": "<<step<<" failed: "<<errors[b]<<std::endl;
+		message += format("%sboard %d: %s", message.empty() ? "" : "; ", b, errors[b].c_str());
+	}
+	if(!message.empty()) {
+		throw std::runtime_error(format("%s failed for %s", step, message.c_str()));
+	}
+}
+
+void CaenDigitizer::UpdateSetupStatistics(const char* step, double elapsed)
+{
+	// print and write to the ODB how long each step took for each board, to see where the run-start latency comes from
+	std::cout<<step<<" of "<<fSettings->NumberOfBoards()<<" board(s) took "<<elapsed<<" ms"<<(fSettings->ParallelSetup() ? " (parallel)":"")<<std::endl;
+	std::vector<float> open(fSettings->NumberOfBoards());
+	std::vector<float> program(fSettings->NumberOfBoards());
+	std::vector<float> allocate(fSettings->NumberOfBoards());
+	std::vector<float> calibrate(fSettings->NumberOfBoards());
+	// register accesses during the last programming, and how many plain read-modify-write cycles would have needed
+	std::vector<DWORD> roundTrips(fSettings->NumberOfBoards());
+	std::vector<DWORD> uncachedRoundTrips(fSettings->NumberOfBoards());
+	for(int b = 0; b < fSettings->NumberOfBoards(); ++b) {
+		open[b]      = fSetupTime[b].fOpen;
+		program[b]   = fSetupTime[b].fProgram;
+		allocate[b]  = fSetupTime[b].fAllocate;
+		calibrate[b] = fSetupTime[b].fCalibrate;
+		roundTrips[b]         = fRegisters[b].RoundTrips();
+		uncachedRoundTrips[b] = fRegisters[b].UncachedRoundTrips();
+		if(fDebug) {
+			std::cout<<"board "<<b<<": open "<<open[b]<<" ms, program "<<program[b]<<" ms, allocate "<<allocate[b]<<" ms, calibrate "<<calibrate[b]<<" ms, "
+				<<roundTrips[b]<<" register accesses ("<<uncachedRoundTrips[b]<<" without cache)"<<std::endl;
+		}
+	}
+	if(open.empty()) return;
+	float total = elapsed;
+	db_set_value(fOdb, 0, format("/DAQ/statistics/VX1730/Time of last %s (ms)", step).c_str(), &total, sizeof(total), 1, TID_FLOAT);
+	db_set_value(fOdb, 0, "/DAQ/statistics/VX1730/Open time (ms)", open.data(), open.size()*sizeof(float), open.size(), TID_FLOAT);
+	db_set_value(fOdb, 0, "/DAQ/statistics/VX1730/Program time (ms)", program.data(), program.size()*sizeof(float), program.size(), TID_FLOAT);
+	db_set_value(fOdb, 0, "/DAQ/statistics/VX1730/Allocation time (ms)", allocate.data(), allocate.size()*sizeof(float), allocate.size(), TID_FLOAT);
+	db_set_value(fOdb, 0, "/DAQ/statistics/VX1730/Calibration time (ms)", calibrate.data(), calibrate.size()*sizeof(float), calibrate.size(), TID_FLOAT);
+	db_set_value(fOdb, 0, "/DAQ/statistics/VX1730/Register accesses", roundTrips.data(), roundTrips.size()*sizeof(DWORD), roundTrips.size(), TID_DWORD);
+	db_set_value(fOdb, 0, "/DAQ/statistics/VX1730/Register accesses without cache", uncachedRoundTrips.data(), uncachedRoundTrips.size()*sizeof(DWORD), uncachedRoundTrips.size(), TID_DWORD);
 }
 
 CaenDigitizer::~CaenDigitizer()
 {
+	StopReadoutThreads();
+	delete fRawWriter;
 	for(int b = 0; b < fSettings->NumberOfBoards(); ++b) {
 		CAEN_DGTZ_FreeReadoutBuffer(&fBuffer[b]);
+		delete fRingBuffer[b];
 #ifdef USE_WAVEFORMS
 		CAEN_DGTZ_FreeDPPWaveforms(fHandle[b], reinterpret_cast<void*>(fWaveforms[b]));
 #endif
@@ -123,64 +254,281 @@ CaenDigitizer::~CaenDigitizer()
 	}
 }
 
-void CaenDigitizer::StartAcquisition(HNDLE hDB)
+void CaenDigitizer::StartAcquisition(HNDLE hDB, int runNumber)
 {
+	// make sure no readout thread is still accessing the boards
+	StopReadoutThreads();
 	// re-load settings from ODB and set digitzer up (again)
+	fOdb = hDB;
 	fSettings->ReadOdb(hDB);
 	Setup();
+	fCounts.resize(fSettings->NumberOfBoards());
+	for(auto& counts : fCounts) {
+		counts.Clear();
+	}
+	// anything left over from a split readout belongs to the previous run
+	for(int b = 0; b < fSettings->NumberOfBoards(); ++b) {
+		fBlockPending[b] = false;
+		fBlockOffset[b] = 0;
+	}
+	UpdateStatistics();
 	if(fSettings->RawOutput()) {
-		// open raw output file
-		fRawOutput.open("raw.dat");
+		// open raw output file, the writer is re-created in case the settings changed
+		delete fRawWriter;
+		fRawWriter = new CaenRawWriter(fSettings->RawOutputQueueSize(), fSettings->RawOutputFileSize(), fSettings->RawOutputDirectIO(), fDebug);
+		fRawWriter->Open(runNumber);
+		fLastBytesWritten = 0;
 	}
 	// don't need to start acquisition, this is done by the s-in/gpi signal
 	for(int b = 0; b < fSettings->NumberOfBoards(); ++b) {
 		CAEN_DGTZ_SWStartAcquisition(fHandle[b]);
 	}
+	if(fSettings->ThreadedReadout() || fSettings->UseInterrupts()) {
+		StartReadoutThreads();
+	}
 }
 
-void CaenDigitizer::StopAcquisition()
+void CaenDigitizer::StopReadout()
 {
+	// stop readout threads first, so they don't read from the boards while we stop them
+	StopReadoutThreads();
 	// stop acquisition
 	for(int b = 0; b < fSettings->NumberOfBoards(); ++b) {
 		CAEN_DGTZ_SWStopAcquisition(fHandle[b]);
 	}
-	if(fRawOutput.is_open()) {
-		fRawOutput.close();
+}
+
+bool CaenDigitizer::DataLeft()
+{
+	if(SplitPending()) return true;
+	if(fSettings->ThreadedReadout()) {
+		for(int b = 0; b < fSettings->NumberOfBoards(); ++b) {
+			if(!fRingBuffer[b]->Empty()) return true;
+		}
+	}
+	return false;
+}
+
+void CaenDigitizer::StopAcquisition()
+{
+	StopReadout();
+	// normally the stop transition waits until everything has been sent (see fecaen.cxx)
+	DiscardLeftovers();
+	UpdateStatistics();
+	if(fRawWriter != NULL) {
+		fRawWriter->Close();
 	}
 }
 
 void CaenDigitizer::Calibrate()
 {
-	// calibrate all digitizers
-	int errorCode = 0;
+	// calibrate all digitizers, a failed calibration isn't fatal, so we only report it
+	try {
+		ForEachBoard([this](int b) {
+			auto start = std::chrono::steady_clock::now();
+			int errorCode = CAEN_DGTZ_Calibrate(fHandle[b]);
+			fSetupTime[b].fCalibrate = Milliseconds(start);
+			if(errorCode != 0) {
+				throw std::runtime_error(format("Error %d when trying to calibrate handle %d", errorCode, fHandle[b]));
+			}
+		}, "calibration");
+	} catch(std::exception& e) {
+		std::cerr<<e.what()<<std::endl;
+	}
+}
+
+void CaenDigitizer::StartReadoutThreads()
+{
+	// with threaded readout the readout threads wait for the interrupts themselves (if enabled)
+	// otherwise we only start threads that wait for the interrupts and let the MIDAS thread do the readout
+	fReadoutRunning = true;
 	for(int b = 0; b < fSettings->NumberOfBoards(); ++b) {
-		errorCode = CAEN_DGTZ_Calibrate(fHandle[b]);
+		fReadoutError[b] = 0;
+		fIrqPending[b] = false;
+		if(fSettings->ThreadedReadout()) {
+			fRingBuffer[b]->Reset();
+			fReadoutThread.emplace_back(&CaenDigitizer::ReadoutLoop, this, b);
+		} else {
+			fReadoutThread.emplace_back(&CaenDigitizer::InterruptLoop, this, b);
+		}
+	}
+	if(fDebug) std::cout<<"started "<<fReadoutThread.size()<<(fSettings->ThreadedReadout() ? " readout":" interrupt")<<" threads"<<std::endl;
+}
+
+void CaenDigitizer::StopReadoutThreads()
+{
+	{
+		std::lock_guard<std::mutex> lock(fDataMutex);
+		fReadoutRunning = false;
+	}
+	fDataCondition.notify_all();
+	for(auto& thread : fReadoutThread) {
+		thread.join();
+	}
+	fReadoutThread.clear();
+}
+
+void CaenDigitizer::ReadoutLoop(int b)
+{
+	// reads data from board b into the next free slot of its ring buffer until the acquisition is stopped
+	while(fReadoutRunning.load(std::memory_order_relaxed)) {
+		CaenRingBuffer::Slot* slot = fRingBuffer[b]->WriteSlot();
+		if(slot == nullptr) {
+			// ring buffer is full, wait for ReadData to drain it
+			std::this_thread::sleep_for(std::chrono::microseconds(100));
+			continue;
+		}
+		int errorCode;
+		if(fSettings->UseInterrupts()) {
+			// wait for the board to tell us it has data, the timeout makes sure we notice the end of the run
+			errorCode = CAEN_DGTZ_IRQWait(fHandle[b], fSettings->IrqTimeout());
+			if(errorCode == CAEN_DGTZ_Timeout) continue;
+			if(errorCode != 0) {
+				std::cerr<<"Error "<<errorCode<<" when waiting for interrupt from board "<<b<<", stopping readout thread"<<std::endl;
+				fReadoutError[b] = errorCode;
+				NotifyData();
+				return;
+			}
+		}
+		errorCode = CAEN_DGTZ_ReadData(fHandle[b], CAEN_DGTZ_SLAVE_TERMINATED_READOUT_MBLT, slot->fData, &slot->fSize);
 		if(errorCode != 0) {
-			std::cerr<<"Error "<<errorCode<<" when trying to calibrate board "<<b<<", handle "<<fHandle[b]<<std::endl;
+			std::cerr<<"Error "<<errorCode<<" when reading data from board "<<b<<", stopping readout thread"<<std::endl;
+			fReadoutError[b] = errorCode;
+			NotifyData();
+			return;
 		}
+		if(slot->fSize == 0) {
+			// no data, don't hammer the link
+			if(!fSettings->UseInterrupts()) {
+				std::this_thread::sleep_for(std::chrono::milliseconds(1));
+			}
+			continue;
+		}
+		fRingBuffer[b]->CommitWrite();
+		NotifyData();
 	}
 }
 
+void CaenDigitizer::InterruptLoop(int b)
+{
+	// waits for interrupts from board b and flags it as ready, the data is read by ReadData
+	// which clears the flag again, until then we don't wait for another interrupt
+	while(fReadoutRunning.load(std::memory_order_relaxed)) {
+		if(fIrqPending[b]) {
+			std::unique_lock<std::mutex> lock(fDataMutex);
+			fDataCondition.wait_for(lock, std::chrono::milliseconds(fSettings->IrqTimeout()), [this, b] { return !fIrqPending[b] || !fReadoutRunning; });
+			continue;
+		}
+		int errorCode = CAEN_DGTZ_IRQWait(fHandle[b], fSettings->IrqTimeout());
+		if(errorCode == CAEN_DGTZ_Timeout) continue;
+		if(errorCode != 0) {
+			std::cerr<<"Error "<<errorCode<<" when waiting for interrupt from board "<<b<<", stopping interrupt thread"<<std::endl;
+			fReadoutError[b] = errorCode;
+			NotifyData();
+			return;
+		}
+		fIrqPending[b] = true;
+		NotifyData();
+	}
+}
+
+void CaenDigitizer::NotifyData()
+{
+	// taking the lock makes sure WaitForData can't miss the notification between checking and waiting
+	{
+		std::lock_guard<std::mutex> lock(fDataMutex);
+	}
+	fDataCondition.notify_all();
+}
+
+bool CaenDigitizer::DataAvailable()
+{
+	for(int b = 0; b < fSettings->NumberOfBoards(); ++b) {
+		if(fReadoutError[b] != 0) return true;
+		if(fSettings->ThreadedReadout()) {
+			if(!fRingBuffer[b]->Empty()) return true;
+		} else if(fIrqPending[b]) {
+			return true;
+		}
+	}
+	return false;
+}
+
+INT CaenDigitizer::WaitForData(int timeout)
+{
+	// blocks until a readout thread has finished a block or a board raised an interrupt, or the timeout (in ms) expired
+	// the rest of a split readout is always ready
+	if(SplitPending()) return TRUE;
+	if(CanWaitForData() && fReadoutRunning) {
+		std::unique_lock<std::mutex> lock(fDataMutex);
+		fDataCondition.wait_for(lock, std::chrono::milliseconds(timeout), [this] { return !fReadoutRunning || DataAvailable(); });
+	}
+	return DataReady();
+}
+
 INT CaenDigitizer::DataReady()
 {
 	int errorCode = 0;
 
-	// read data
+	// the rest of a split readout has to be sent before we read anything new from these boards
+	if(SplitPending()) return TRUE;
+
+	if(fSettings->ThreadedReadout()) {
+		// the readout threads do the reading, we only need to check whether any of them has finished a block
+		// without running threads (before the first run, or while the stop transition waits for the rings to be sent)
+		// only blocks that are already in the rings count, errors have been reported when the threads stopped
+		bool gotData = false;
+		for(int b = 0; b < fSettings->NumberOfBoards(); ++b) {
+			if(fReadoutRunning && fReadoutError[b] != 0) {
+				std::cerr<<"Error "<<fReadoutError[b]<<" in readout thread of board "<<b<<std::endl;
+				return -1.;
+			}
+			if(!fRingBuffer[b]->Empty()) {
+				gotData = true;
+			}
+		}
+		if(gotData) return TRUE;
+		return FALSE;
+	}
+
+	if(fSettings->UseInterrupts()) {
+		// the interrupt threads tell us which boards have data, no need to read any registers
+		// without them (e.g. when mfe times the polling before the first run) there's nothing to read
+		if(!fReadoutRunning) return FALSE;
+		bool gotData = false;
+		for(int b = 0; b < fSettings->NumberOfBoards(); ++b) {
+			if(fReadoutError[b] != 0) {
+				std::cerr<<"Error "<<fReadoutError[b]<<" in interrupt thread of board "<<b<<std::endl;
+				return -1.;
+			}
+			fEventReady[b] = fIrqPending[b];
+			if(fEventReady[b]) {
+				gotData = true;
+			}
+		}
+		if(gotData) return TRUE;
+		return FALSE;
+	}
+
+	// check acquisition status of each board, the data itself is only transferred in ReadData
+	// this keeps the poll loop down to one register read per board
 	if(fDebug) {
 		std::cout<<"--------------------------------------------------------------------------------"<<std::endl;
 	}
 	bool gotData = false;
+	uint32_t status;
 	for(int b = 0; b < fSettings->NumberOfBoards(); ++b) {
-		errorCode = CAEN_DGTZ_ReadData(fHandle[b], CAEN_DGTZ_SLAVE_TERMINATED_READOUT_MBLT, fBuffer[b], &fBufferSize[b]);
+		errorCode = CAEN_DGTZ_ReadRegister(fHandle[b], 0x8104, &status);
 		if(errorCode != 0) {
-			std::cerr<<"Error "<<errorCode<<" when reading data"<<std::endl;
+			std::cerr<<"Error "<<errorCode<<" when reading acquisition status"<<std::endl;
 			return -1.;
 		}
+		// bit 3 of the acquisition status is set if at least one aggregate is ready for readout
+		fEventReady[b] = ((status & 0x8) == 0x8);
 		if(fDebug) {
-			std::cout<<"Read "<<fBufferSize[b]<<" bytes"<<std::endl;
+			std::cout<<"board "<<b<<": acquisition status 0x"<<std::hex<<status<<std::dec<<(fEventReady[b]?", event ready":"")<<std::endl;
 		}
-		if(fBufferSize[b] > 0) {
-			//std::cout<<std::endl<<__PRETTY_FUNCTION__<<": got "<<fBufferSize[b]<<" bytes from board "<<b<<std::endl;
+		if(fEventReady[b]) {
 			gotData = true;
 		}
 	}
@@ -197,11 +545,40 @@ uint32_t CaenDigitizer::ReadData(char* event, const char* bankName)
 {
 	// creates bank at <event> and copies all data from fBuffer to it
 	// no checks for valid events done, nor any identification of board/channel???
+	// if the rest of a split readout is pending, only that is sent and no new data is read
+	bool pending = SplitPending();
+	if(!fSettings->ThreadedReadout() && fSettings->ZeroCopy() && !pending) {
+		return ReadDirect(event, bankName);
+	}
 	DWORD* data;
+	int errorCode = 0;
+	if(!fSettings->ThreadedReadout() && !pending) {
+		// read data from all boards that had an event ready when we last checked
+		for(int b = 0; b < fSettings->NumberOfBoards(); ++b) {
+			fBufferSize[b] = 0;
+			if(!fEventReady[b]) continue;
+			errorCode = CAEN_DGTZ_ReadData(fHandle[b], CAEN_DGTZ_SLAVE_TERMINATED_READOUT_MBLT, fBuffer[b], &fBufferSize[b]);
+			if(errorCode != 0) {
+				std::cerr<<"Error "<<errorCode<<" when reading data"<<std::endl;
+				fBufferSize[b] = 0;
+			}
+			if(fDebug) {
+				std::cout<<"Read "<<fBufferSize[b]<<" bytes"<<std::endl;
+			}
+			fEventReady[b] = false;
+			if(fSettings->UseInterrupts()) fIrqPending[b] = false;
+		}
+		// let the interrupt threads wait for the next interrupt
+		if(fSettings->UseInterrupts()) NotifyData();
+	}
 	//check if we have any data
 	int sum = 0;
 	for(int b = 0; b < fSettings->NumberOfBoards(); ++b) {
-		if(fBufferSize[b] >= 0) sum += fBufferSize[b];
+		if(pending) {
+			if(fBlockPending[b]) ++sum;
+		} else if(fSettings->ThreadedReadout()) {
+			if(!fRingBuffer[b]->Empty()) ++sum;
+		} else if(fBufferSize[b] >= 0) sum += fBufferSize[b];
 		else std::cerr<<"buffer size of board "<<b<<" is negative: "<<fBufferSize[b]<<std::endl;
 	}
 	if(sum == 0) {
@@ -210,22 +587,25 @@ uint32_t CaenDigitizer::ReadData(char* event, const char* bankName)
 	}
 	//create bank - returns pointer to data area of bank
 	bk_create(event, bankName, TID_DWORD, reinterpret_cast<void**>(&data));
+	DWORD* bank = data;
 	//copy all events from fBuffer to data
 	uint32_t sumEvents = 0;
 	if(fDebug) std::cout<<"#events read: ";
 	for(int b = 0; b < fSettings->NumberOfBoards(); ++b) {
-		if(fBufferSize[b] == 0) continue;
-		//copy buffer of this board
-		std::memcpy(data, fBuffer[b], fBufferSize[b]);
-		data += fBufferSize[b]/sizeof(DWORD);
-		if(fRawOutput.is_open()) {
-			fRawOutput.write(fBuffer[b], fBufferSize[b]);
+		if(pending && !fBlockPending[b]) continue;
+		if(fSettings->ThreadedReadout()) {
+			// only take one block per board, so the bank doesn't grow beyond what a direct readout would give
+			// any other blocks will be picked up by the next call
+			CaenRingBuffer::Slot* slot = fRingBuffer[b]->ReadSlot();
+			if(slot == nullptr) continue;
+			// the slot is only released once all of it has been sent
+			if(AddBlock(event, bank, data, b, slot->fData, slot->fSize, sumEvents)) {
+				fRingBuffer[b]->CommitRead();
+			}
+		} else {
+			if(fBufferSize[b] == 0) continue;
+			AddBlock(event, bank, data, b, fBuffer[b], fBufferSize[b], sumEvents);
 		}
-
-		uint32_t numEvents;
-		CAEN_DGTZ_GetNumEvents(fHandle[b], fBuffer[b], fBufferSize[b], &numEvents);
-		if(fDebug) std::cout<<"board "<<b<<": "<<std::setw(8)<<numEvents<<" ";
-		sumEvents += numEvents;
 	}
 	if(fDebug) std::cout<<"total: "<<std::setw(8)<<sumEvents<<std::endl;
 	
@@ -235,20 +615,273 @@ uint32_t CaenDigitizer::ReadData(char* event, const char* bankName)
 	return sumEvents;
 }
 
+uint32_t CaenDigitizer::ReadDirect(char* event, const char* bankName)
+{
+	// creates bank at <event> and lets the boards write their data straight into it
+	// this avoids copying the data from the readout buffer, as long as the bank has enough space left for a full readout
+	DWORD* data;
+	int errorCode = 0;
+	//create bank - returns pointer to data area of bank
+	bk_create(event, bankName, TID_DWORD, reinterpret_cast<void**>(&data));
+	DWORD* bank = data;
+	uint32_t sumEvents = 0;
+	if(fDebug) std::cout<<"#events read: ";
+	for(int b = 0; b < fSettings->NumberOfBoards(); ++b) {
+		if(!fEventReady[b]) continue;
+		fEventReady[b] = false;
+		if(fSettings->UseInterrupts()) fIrqPending[b] = false;
+		uint32_t used = UsedEventSize(event, data);
+		char* buffer = fBuffer[b];
+		if(fMaxEventSize > 0 && used + fReadoutBufferSize[b] <= fMaxEventSize) {
+			buffer = reinterpret_cast<char*>(data);
+		}
+		errorCode = CAEN_DGTZ_ReadData(fHandle[b], CAEN_DGTZ_SLAVE_TERMINATED_READOUT_MBLT, buffer, &fBufferSize[b]);
+		if(errorCode != 0) {
+			std::cerr<<"Error "<<errorCode<<" when reading data"<<std::endl;
+			continue;
+		}
+		if(fDebug) {
+			std::cout<<"Read "<<fBufferSize[b]<<" bytes"<<(buffer == fBuffer[b] ? " into readout buffer":" into bank")<<std::endl;
+		}
+		if(fBufferSize[b] == 0) continue;
+		if(buffer == fBuffer[b]) {
+			// this might not fit into the space left, so it might have to be split
+			AddBlock(event, bank, data, b, buffer, fBufferSize[b], sumEvents);
+		} else {
+			sumEvents += AddToBank(data, b, buffer, fBufferSize[b]);
+		}
+	}
+	if(fDebug) std::cout<<"total: "<<std::setw(8)<<sumEvents<<std::endl;
+	// let the interrupt threads wait for the next interrupt
+	if(fSettings->UseInterrupts()) NotifyData();
+
+	//close bank
+	bk_close(event, data);
+
+	return sumEvents;
+}
+
+bool CaenDigitizer::AddBlock(char* event, DWORD* bank, DWORD*& data, int b, char* buffer, uint32_t size, uint32_t& nofEvents)
+{
+	// adds the part of the readout of board b that hasn't been sent yet to the bank
+	// if it doesn't fit into the space left in the event, only as many whole board aggregates as fit are added
+	// returns true if the whole readout has been sent, otherwise the rest is left for the next event
+	char* begin = buffer + fBlockOffset[b];
+	uint32_t left = size - fBlockOffset[b];
+	uint32_t fit = left;
+	uint32_t used = UsedEventSize(event, data);
+	if(fMaxEventSize > 0 && used + left > fMaxEventSize) {
+		uint32_t space = (used < fMaxEventSize) ? fMaxEventSize - used : 0;
+		const uint32_t* words = reinterpret_cast<const uint32_t*>(begin);
+		uint32_t nofWords = left/sizeof(uint32_t);
+		uint32_t fitWords = 0;
+		CaenBoardAggregate board;
+		while(fitWords < nofWords && board.Read(words + fitWords, nofWords - fitWords) && (fitWords + board.fNofWords)*sizeof(uint32_t) <= space) {
+			fitWords += board.fNofWords;
+		}
+		fit = fitWords*sizeof(uint32_t);
+		if(fit == 0 && data == bank) {
+			// not even one aggregate fits into an empty event, we have to drop the rest of this readout
+			cm_msg(MERROR, "AddBlock", "Dropping %u bytes of board %d, board aggregate doesn't fit into maximum event size of %u bytes, frontend needs to be restarted", left, b, fMaxEventSize);
+			fBlockPending[b] = false;
+			fBlockOffset[b] = 0;
+			return true;
+		}
+	}
+	if(fit > 0) {
+		nofEvents += AddToBank(data, b, begin, fit);
+	}
+	if(fit == left) {
+		fBlockPending[b] = false;
+		fBlockOffset[b] = 0;
+		return true;
+	}
+	if(fDebug) std::cout<<"split readout of board "<<b<<", "<<left - fit<<" bytes left for next event"<<std::endl;
+	fBlockPending[b] = true;
+	fBlockOffset[b] += fit;
+	return false;
+}
+
+void CaenDigitizer::DiscardLeftovers()
+{
+	// counts and drops the readouts that have been read from the boards but couldn't be sent anymore,
+	// so they're not silently thrown away when the ring buffers are reset at the next start
+	for(int b = 0; b < fSettings->NumberOfBoards(); ++b) {
+		uint32_t nofBlocks = 0;
+		uint64_t nofBytes = 0;
+		if(fSettings->ThreadedReadout()) {
+			// the rest of a split readout is the oldest slot of the ring buffer
+			for(CaenRingBuffer::Slot* slot = fRingBuffer[b]->ReadSlot(); slot != nullptr; slot = fRingBuffer[b]->ReadSlot()) {
+				++nofBlocks;
+				nofBytes += slot->fSize - fBlockOffset[b];
+				fBlockOffset[b] = 0;
+				fRingBuffer[b]->CommitRead();
+			}
+		} else if(fBlockPending[b]) {
+			++nofBlocks;
+			nofBytes += fBufferSize[b] - fBlockOffset[b];
+		}
+		fBlockPending[b] = false;
+		fBlockOffset[b] = 0;
+		if(nofBlocks > 0) {
+			cm_msg(MERROR, "StopAcquisition", "Dropping %u readouts (%llu bytes) of board %d that couldn't be sent before the end of the run", nofBlocks, static_cast<unsigned long long>(nofBytes), b);
+		}
+	}
+}
+
+uint32_t CaenDigitizer::UsedEventSize(const char* event, const DWORD* data)
+{
+	// space already used in the event, this includes the event and bank header(s),
+	// plus room for the padding added by bk_close
+	return sizeof(EVENT_HEADER) + (reinterpret_cast<const char*>(data) - event) + 8;
+}
+
+bool CaenDigitizer::SplitPending()
+{
+	for(int b = 0; b < fSettings->NumberOfBoards(); ++b) {
+		if(fBlockPending[b]) return true;
+	}
+	return false;
+}
+
+uint32_t CaenDigitizer::MaxAggregateSize(int b)
+{
+	// worst-case size in bytes of one board aggregate of board b, from record length, channel mask, and event aggregation
+	// returns 0 if the number of events per aggregate is left for the library to decide
+	if(fSettings->EventAggregation(b) <= 0) return 0;
+	uint32_t words = 4; // board aggregate header
+	for(int ch = 0; ch < fSettings->NumberOfChannels(); ch += 2) {
+		if(((fSettings->ChannelMask(b)>>ch) & 0x3) == 0) continue;
+		// trigger time tag, charge, and the extras word (which we always enable)
+		uint32_t eventWords = 3;
+		if(fSettings->AcquisitionMode(b) != CAEN_DGTZ_DPP_ACQ_MODE_List) {
+			// the record length is set per channel pair in multiples of 8 samples, with two samples per word
+			eventWords += 4*((fSettings->RecordLength(b, ch) + 7)/8);
+		}
+		// channel aggregate header and events of both channels
+		words += 2 + fSettings->EventAggregation(b)*eventWords;
+	}
+	return words*sizeof(uint32_t);
+}
+
+uint32_t CaenDigitizer::WorstCaseEventSize()
+{
+	// the library sizes the readout buffers for the largest readout possible with the current settings
+	uint32_t size = sizeof(EVENT_HEADER) + sizeof(BANK_HEADER) + sizeof(BANK32) + 8;
+	for(int b = 0; b < fSettings->NumberOfBoards(); ++b) {
+		size += std::max(fReadoutBufferSize[b], MaxAggregateSize(b));
+	}
+	return size;
+}
+
+uint32_t CaenDigitizer::MinimumEventSize()
+{
+	// readouts can only be split between board aggregates, so the largest one has to fit into an event
+	// if the library decides the aggregation we have to assume a full readout is one aggregate
+	uint32_t size = 0;
+	for(int b = 0; b < fSettings->NumberOfBoards(); ++b) {
+		uint32_t aggregateSize = MaxAggregateSize(b);
+		if(aggregateSize == 0) aggregateSize = fReadoutBufferSize[b];
+		size = std::max(size, aggregateSize);
+	}
+	return size + sizeof(EVENT_HEADER) + sizeof(BANK_HEADER) + sizeof(BANK32) + 8;
+}
+
+uint32_t CaenDigitizer::AddToBank(DWORD*& data, int b, char* buffer, uint32_t size)
+{
+	//copy buffer of this board, unless it has been read into the bank directly
+	if(buffer != reinterpret_cast<char*>(data)) {
+		std::memcpy(data, buffer, size);
+	}
+	data += size/sizeof(DWORD);
+	if(fRawWriter != NULL && fRawWriter->IsOpen()) {
+		fRawWriter->Write(buffer, size);
+	}
+
+	// count events from the aggregate headers, this also gives us the statistics per channel pair
+	// the counts are only added to the run statistics if the whole buffer could be walked
+	uint32_t numEvents = 0;
+	CaenAggregateCounts counts;
+	counts.Clear();
+	if(CaenAggregate::Count(reinterpret_cast<const uint32_t*>(buffer), size/sizeof(uint32_t), counts)) {
+		numEvents = counts.fNofEvents;
+		fCounts[b].Add(counts);
+	} else {
+		std::cerr<<"Failed to walk aggregates of "<<size<<" bytes from board "<<b<<", using CAEN_DGTZ_GetNumEvents instead"<<std::endl;
+		CAEN_DGTZ_GetNumEvents(fHandle[b], buffer, size, &numEvents);
+	}
+	if(fDebug) std::cout<<"board "<<b<<": "<<std::setw(8)<<numEvents<<" ";
+
+	// don't write the statistics more than once per second
+	if(ss_millitime() - fLastStatisticsUpdate > 1000) {
+		UpdateStatistics();
+	}
+	return numEvents;
+}
+
+void CaenDigitizer::UpdateStatistics()
+{
+	// write events per board and per channel pair to the ODB
+	std::vector<DWORD> boardEvents(fCounts.size());
+	std::vector<DWORD> pairEvents(8*fCounts.size());
+	for(size_t b = 0; b < fCounts.size(); ++b) {
+		boardEvents[b] = fCounts[b].fNofEvents;
+		for(int pair = 0; pair < 8; ++pair) {
+			pairEvents[8*b + pair] = fCounts[b].fChannelEvents[2*pair];
+		}
+	}
+	DWORD now = ss_millitime();
+	DWORD elapsed = now - fLastStatisticsUpdate;
+	fLastStatisticsUpdate = now;
+	if(boardEvents.empty()) return;
+	db_set_value(fOdb, 0, "/DAQ/statistics/VX1730/Events per board", boardEvents.data(), boardEvents.size()*sizeof(DWORD), boardEvents.size(), TID_DWORD);
+	db_set_value(fOdb, 0, "/DAQ/statistics/VX1730/Events per channel pair", pairEvents.data(), pairEvents.size()*sizeof(DWORD), pairEvents.size(), TID_DWORD);
+
+	if(fRawWriter != NULL && fRawWriter->IsOpen()) {
+		// queue depth (in chunks) and write throughput of the raw output
+		INT queueDepth = fRawWriter->QueueDepth();
+		INT queueSize = fRawWriter->QueueSize();
+		uint64_t bytesWritten = fRawWriter->BytesWritten();
+		float rate = 0.;
+		if(elapsed > 0) {
+			rate = (bytesWritten - fLastBytesWritten)/(1.024*1024.*elapsed); // MB/s from bytes/ms
+		}
+		fLastBytesWritten = bytesWritten;
+		float dropped = fRawWriter->BytesDropped()/(1024.*1024.);
+		db_set_value(fOdb, 0, "/DAQ/statistics/VX1730/Raw output queue depth", &queueDepth, sizeof(queueDepth), 1, TID_INT);
+		db_set_value(fOdb, 0, "/DAQ/statistics/VX1730/Raw output queue size", &queueSize, sizeof(queueSize), 1, TID_INT);
+		db_set_value(fOdb, 0, "/DAQ/statistics/VX1730/Raw output rate (MB/s)", &rate, sizeof(rate), 1, TID_FLOAT);
+		db_set_value(fOdb, 0, "/DAQ/statistics/VX1730/Raw output dropped (MB)", &dropped, sizeof(dropped), 1, TID_FLOAT);
+	}
+}
+
 void CaenDigitizer::ProgramDigitizer(int b)
 {
 	uint32_t address;
 	uint32_t data;
 
+	if(!fSettings->ResetNeeded(b)) {
+		// the board has been programmed before and none of the changes need a reset
+		ReprogramDigitizer(b);
+		return;
+	}
+
 	if(fDebug) std::cout<<"programming digitizer "<<b<<std::endl;
 	CAEN_DGTZ_ErrorCode errorCode;
 
+	// if anything goes wrong we want a full reset next time
+	fSettings->ForgetProgrammed(b);
+
 	errorCode = CAEN_DGTZ_Reset(fHandle[b]);
 
 	if(errorCode != 0) {
 		throw std::runtime_error(format("Error %d when resetting digitizer", errorCode));
 	}
 
+	// after the reset we don't know anything about the registers anymore
+	fRegisters[b].Clear();
+	fRegisters[b].ResetCounters();
+
 	errorCode = CAEN_DGTZ_SetDPPAcquisitionMode(fHandle[b], fSettings->AcquisitionMode(b), CAEN_DGTZ_DPP_SAVE_PARAM_EnergyAndTime);
 	//CAEN_DGTZ_DPP_AcqMode_t mode;
 	//CAEN_DGTZ_DPP_SaveParam_t param;
@@ -293,12 +926,13 @@ void CaenDigitizer::ProgramDigitizer(int b)
 		throw std::runtime_error(format("Error %d when setting dpp parameters", errorCode));
 	}
 
-	// write some special registers directly
+	// write some special registers directly, these are collected in the register cache and written together
+	// once all library calls that write the same registers are done
 	// enable EXTRA word
-	address = 0x8000;
-	CAEN_DGTZ_ReadRegister(fHandle[b], address, &data);
-	data |= 0x20000; // no mask necessary, we just set one bit
-	CAEN_DGTZ_WriteRegister(fHandle[b], address, data);
+	fRegisters[b].Modify(0x8000, 0x20000, 0x20000);
+	// the board ID goes into every board aggregate header, use the board number so the boards can be told apart when
+	// the data is decoded (otherwise it's the GEO address of VME64X crates, or 0)
+	fRegisters[b].Write(0xef08, b);
 
 	for(int ch = 0; ch < fSettings->NumberOfChannels(); ++ch) {
 		if((fSettings->ChannelMask(b) & (1<<ch)) != 0) {
@@ -316,27 +950,16 @@ void CaenDigitizer::ProgramDigitizer(int b)
 			if(fSettings->EnableCfd(b, ch)) {
 				if(fDebug) std::cout<<"enabling CFD on channel "<<ch<<std::endl;
 				// enable CFD mode
-				address = 0x1080 + ch*0x100;
-				CAEN_DGTZ_ReadRegister(fHandle[b], address, &data);
-				data |= 0x40; // no mask necessary, we just set one bit
-				CAEN_DGTZ_WriteRegister(fHandle[b], address, data);
+				fRegisters[b].Modify(0x1080 + ch*0x100, 0x40, 0x40);
 
 				// set CFD parameters
-				address = 0x103c + ch*0x100;
-				CAEN_DGTZ_ReadRegister(fHandle[b], address, &data);
-				data = (data & ~0xfff) | fSettings->CfdParameters(b, ch);
-				CAEN_DGTZ_WriteRegister(fHandle[b], address, data);
+				fRegisters[b].Modify(0x103c + ch*0x100, 0xfff, fSettings->CfdParameters(b, ch));
 			}
 			// write extended TS, flags, and fine TS (from CFD) to extra word
-			address = 0x1084 + ch*0x100;
-			CAEN_DGTZ_ReadRegister(fHandle[b], address, &data);
-			data = (data & ~0x700) | 0x200;
-			CAEN_DGTZ_WriteRegister(fHandle[b], address, data);
+			fRegisters[b].Modify(0x1084 + ch*0x100, 0x700, 0x200);
 		}
 	}
 
-	errorCode = CAEN_DGTZ_SetDPPEventAggregation(fHandle[b], fSettings->EventAggregation(b), 0);
-
 	// doesn't work??? we set it now by hand below
 	errorCode = CAEN_DGTZ_SetDPP_VirtualProbe(fHandle[b], ANALOG_TRACE_2,  CAEN_DGTZ_DPP_VIRTUALPROBE_CFD);
 
@@ -345,11 +968,29 @@ void CaenDigitizer::ProgramDigitizer(int b)
 
 	errorCode = CAEN_DGTZ_SetDPP_VirtualProbe(fHandle[b], DIGITAL_TRACE_2, CAEN_DGTZ_DPP_DIGITALPROBE_GateShort);
 
-	// manually set analog traces to input and cfd
-	address = 0x8000;
-	CAEN_DGTZ_ReadRegister(fHandle[b], address, &data);
-	data = (data & ~0x3000) | 0x2000;
-	CAEN_DGTZ_WriteRegister(fHandle[b], address, data);
+	// manually set analog traces to input and cfd (merged with the EXTRA word bit from above)
+	fRegisters[b].Modify(0x8000, 0x3000, 0x2000);
+
+	// the library calls above wrote (some of) these registers, so re-read them before writing our changes
+	fRegisters[b].Invalidate();
+	errorCode = static_cast<CAEN_DGTZ_ErrorCode>(fRegisters[b].Flush());
+
+	if(errorCode != 0) {
+		throw std::runtime_error(format("Error %d when writing registers", errorCode));
+	}
+
+	// this only writes the aggregation and buffer organisation registers, so it doesn't interfere with the registers above
+	errorCode = CAEN_DGTZ_SetDPPEventAggregation(fHandle[b], fSettings->EventAggregation(b), 0);
+
+	// interrupts are acknowledged automatically (ROAK), the status/ID is the board number
+	// no need to disable them otherwise, the reset above already did that
+	if(fSettings->UseInterrupts()) {
+		errorCode = CAEN_DGTZ_SetInterruptConfig(fHandle[b], CAEN_DGTZ_ENABLE, fSettings->IrqLevel(), b, fSettings->EventsPerInterrupt(), CAEN_DGTZ_IRQ_MODE_ROAK);
+
+		if(errorCode != 0) {
+			throw std::runtime_error(format("Error %d when setting interrupt configuration", errorCode));
+		}
+	}
 
 	// use external clock - this seems to be safer if done at the end of setting all parameters ???
 	if(fSettings->UseExternalClock()) {
@@ -362,13 +1003,122 @@ void CaenDigitizer::ProgramDigitizer(int b)
 				cm_msg(MERROR, "ProgramDigitizer", "Requested external clock for VME module, this has to be set by onboard switch S3 (0x%x)", data);
 			}
 		} else {
-			address = 0x8100;
-			CAEN_DGTZ_ReadRegister(fHandle[b], address, &data);
-			data |= 0x40; // no mask necessary, we just set one bit
-			CAEN_DGTZ_WriteRegister(fHandle[b], address, data);
+			// the acquisition control register is also written by the library, so don't rely on what we know about it
+			fRegisters[b].Invalidate();
+			fRegisters[b].Modify(0x8100, 0x40, 0x40);
+			errorCode = static_cast<CAEN_DGTZ_ErrorCode>(fRegisters[b].Flush());
+
+			if(errorCode != 0) {
+				throw std::runtime_error(format("Error %d when selecting external clock", errorCode));
+			}
 		}
 	}
 
+	fSettings->Programmed(b);
+
 	if(fDebug) std::cout<<"done with digitizer "<<b<<std::endl;
 }
 
+void CaenDigitizer::ReprogramDigitizer(int b)
+{
+	// writes only the settings that changed since board b was last programmed, without resetting it
+	// the board keeps whatever was left over from the last run, so we clear that first (the reset would have done that)
+	CAEN_DGTZ_ErrorCode errorCode;
+
+	// starting and stopping the acquisition writes registers, so we can't trust what we knew about them
+	fRegisters[b].Invalidate();
+	fRegisters[b].ResetCounters();
+
+	errorCode = CAEN_DGTZ_ClearData(fHandle[b]);
+
+	if(errorCode != 0) {
+		throw std::runtime_error(format("Error %d when clearing data", errorCode));
+	}
+
+	// setting the DPP parameters also writes the DPP algorithm control registers, which overwrites our CFD settings
+	// so if the board settings changed we have to write the CFD and extras settings of all channels again
+	bool boardChanged = fSettings->BoardChanged(b);
+	std::vector<int> changedChannels;
+	for(int ch = 0; ch < fSettings->NumberOfChannels(); ++ch) {
+		if((fSettings->ChannelMask(b) & (1<<ch)) != 0 && (boardChanged || fSettings->ChannelChanged(b, ch))) {
+			changedChannels.push_back(ch);
+		}
+	}
+	if(!boardChanged && changedChannels.empty()) {
+		if(fDebug) std::cout<<"settings of digitizer "<<b<<" unchanged, not re-programming it"<<std::endl;
+		return;
+	}
+	if(fDebug) std::cout<<"re-programming digitizer "<<b<<": "<<(boardChanged ? "board settings and ":"")<<changedChannels.size()<<" channel(s) changed"<<std::endl;
+
+	// copy the last settings, as we invalidate them in case anything goes wrong
+	BoardSettings last = fSettings->LastProgrammed(b);
+	fSettings->ForgetProgrammed(b);
+
+	if(boardChanged) {
+		if(fSettings->IOLevel(b) != last.IOLevel()) {
+			errorCode = CAEN_DGTZ_SetIOLevel(fHandle[b], fSettings->IOLevel(b));
+
+			if(errorCode != 0) {
+				throw std::runtime_error(format("Error %d when setting IO level", errorCode));
+			}
+		}
+
+		if(fSettings->TriggerMode(b) != last.TriggerMode()) {
+			errorCode = CAEN_DGTZ_SetExtTriggerInputMode(fHandle[b], fSettings->TriggerMode(b));
+
+			if(errorCode != 0) {
+				throw std::runtime_error(format("Error %d when setting external trigger DPP events", errorCode));
+			}
+		}
+
+		// everything else that isn't handled by ResetNeeded is part of the DPP parameters
+		// these can only be set all at once
+		errorCode = CAEN_DGTZ_SetDPPParameters(fHandle[b], fSettings->ChannelMask(b), const_cast<void*>(static_cast<const void*>(fSettings->ChannelParameter(b))));
+
+		if(errorCode != 0) {
+			throw std::runtime_error(format("Error %d when setting dpp parameters", errorCode));
+		}
+	}
+
+	for(int ch : changedChannels) {
+		if(fDebug) std::cout<<"re-programming channel "<<ch<<std::endl;
+		if(fSettings->DCOffset(b, ch) != last.DCOffset(ch)) {
+			errorCode = CAEN_DGTZ_SetChannelDCOffset(fHandle[b], ch, fSettings->DCOffset(b, ch));
+		}
+
+		if(fSettings->PreTrigger(b, ch) != last.PreTrigger(ch)) {
+			errorCode = CAEN_DGTZ_SetDPPPreTriggerSize(fHandle[b], ch, fSettings->PreTrigger(b, ch));
+		}
+
+		if(fSettings->PulsePolarity(b, ch) != last.PulsePolarity(ch)) {
+			errorCode = CAEN_DGTZ_SetChannelPulsePolarity(fHandle[b], ch, fSettings->PulsePolarity(b, ch));
+		}
+
+		if(boardChanged || fSettings->EnableCfd(b, ch) != last.EnableCfd(ch)) {
+			// without a reset we also have to be able to turn CFD mode off again
+			fRegisters[b].Modify(0x1080 + ch*0x100, 0x40, fSettings->EnableCfd(b, ch) ? 0x40 : 0x0);
+		}
+
+		if(fSettings->EnableCfd(b, ch) && (boardChanged || fSettings->CfdParameters(b, ch) != last.CfdParameters(ch) || !last.EnableCfd(ch))) {
+			fRegisters[b].Modify(0x103c + ch*0x100, 0xfff, fSettings->CfdParameters(b, ch));
+		}
+
+		if(boardChanged) {
+			// write extended TS, flags, and fine TS (from CFD) to extra word
+			fRegisters[b].Modify(0x1084 + ch*0x100, 0x700, 0x200);
+		}
+	}
+
+	// the library calls above wrote (some of) these registers
+	fRegisters[b].Invalidate();
+	errorCode = static_cast<CAEN_DGTZ_ErrorCode>(fRegisters[b].Flush());
+
+	if(errorCode != 0) {
+		throw std::runtime_error(format("Error %d when writing registers", errorCode));
+	}
+
+	fSettings->Programmed(b);
+
+	if(fDebug) std::cout<<"done re-programming digitizer "<<b<<std::endl;
+}
+
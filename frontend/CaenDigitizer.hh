@@ -3,40 +3,119 @@
 #include <vector>
 #include <string>
 #include <functional>
-#include <fstream>
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
 
 #include "midas.h"
 
 #include "CaenSettings.hh"
+#include "CaenRingBuffer.hh"
+#include "CaenAggregate.hh"
+#include "CaenRawWriter.hh"
+#include "CaenRegisterCache.hh"
 
 class CaenDigitizer {
 public:
 	CaenDigitizer(HNDLE hDB, bool debug = false);
 	~CaenDigitizer();
 
-	void StartAcquisition(HNDLE hDB);
+	void StartAcquisition(HNDLE hDB, int runNumber);
+	// stops the readout threads and the acquisition of the boards, data that has already been read
+	// (in the ring buffers or the rest of a split readout) can still be sent with ReadData
+	void StopReadout();
+	// whether any data that has been read from the boards still needs to be sent
+	bool DataLeft();
+	// stops the readout (if not done yet), anything that hasn't been sent by now is reported as lost
 	void StopAcquisition();
 	INT  DataReady();
+	INT  WaitForData(int timeout);
+	bool CanWaitForData() const { return fSettings->ThreadedReadout() || fSettings->UseInterrupts(); }
 	uint32_t ReadData(char* event, const char* bankName);
 	void Calibrate();
 
+	void MaxEventSize(uint32_t val) { fMaxEventSize = val; }
+	// event size needed to hold a full readout of all boards, and the smallest size that can still hold the data
+	// (one board aggregate per event), based on the current settings
+	uint32_t WorstCaseEventSize();
+	uint32_t MinimumEventSize();
+
 private:
 	void Setup();
+	void SetupBoard(int board);
+	void ForEachBoard(const std::function<void(int)>& func, const char* step);
+	void UpdateSetupStatistics(const char* step, double elapsed);
 	void ProgramDigitizer(int board);
+	void ReprogramDigitizer(int board);
+	void StartReadoutThreads();
+	void StopReadoutThreads();
+	void ReadoutLoop(int board);
+	void InterruptLoop(int board);
+	bool DataAvailable();
+	void NotifyData();
+	uint32_t ReadDirect(char* event, const char* bankName);
+	bool AddBlock(char* event, DWORD* bank, DWORD*& data, int board, char* buffer, uint32_t size, uint32_t& nofEvents);
+	uint32_t AddToBank(DWORD*& data, int board, char* buffer, uint32_t size);
+	uint32_t UsedEventSize(const char* event, const DWORD* data);
+	bool SplitPending();
+	void DiscardLeftovers();
+	uint32_t MaxAggregateSize(int board);
+	void UpdateStatistics();
 
+	HNDLE fOdb;
 	CaenSettings* fSettings;
 
 	std::vector<int> fHandle;
+	// shadow registers of each board, used by ProgramDigitizer/ReprogramDigitizer
+	std::vector<CaenRegisterCache> fRegisters;
 	// raw readout data
 	std::vector<char*>    fBuffer; 
 	std::vector<uint32_t> fBufferSize;
+	std::vector<uint32_t> fReadoutBufferSize; // allocated size of the readout buffers
+	// boards that reported an event ready in the last call to DataReady
+	std::vector<bool>     fEventReady;
 	// DPP events
 	//std::vector<CAEN_DGTZ_DPP_PSD_Event_t**> fEvents;
 	//std::vector<std::vector<uint32_t> >      fNofEvents;
 	// waveforms
 	std::vector<CAEN_DGTZ_DPP_PSD_Waveforms_t*> fWaveforms;
 
-	std::ofstream fRawOutput;
+	// threaded readout: one thread per board filling its ring buffer
+	std::vector<CaenRingBuffer*> fRingBuffer;
+	std::vector<std::thread> fReadoutThread;
+	std::vector<std::atomic<int> > fReadoutError;
+	std::atomic<bool> fReadoutRunning;
+
+	// interrupts: one thread per board waiting for its IRQ (only used without threaded readout)
+	std::vector<std::atomic<bool> > fIrqPending;
+	// signals that a readout thread finished a block, or an interrupt arrived
+	std::mutex fDataMutex;
+	std::condition_variable fDataCondition;
+
+	CaenRawWriter* fRawWriter;
+
+	uint32_t fMaxEventSize; // maximum size of a MIDAS event, 0 if unknown
+
+	// readouts that don't fit into one MIDAS event are split at board aggregate boundaries
+	// the rest stays in the readout buffer (or ring buffer slot) and goes into the next event(s)
+	std::vector<bool>     fBlockPending; // part of the last readout of this board still needs to be sent
+	std::vector<uint32_t> fBlockOffset;  // bytes of the last readout already sent
+
+	// events counted from the aggregate headers during this run, per board
+	std::vector<CaenAggregateCounts> fCounts;
+	DWORD fLastStatisticsUpdate;
+	uint64_t fLastBytesWritten;
+
+	// time in ms each step of the setup took, per board
+	struct SetupTime {
+		double fOpen;
+		double fProgram;
+		double fAllocate;
+		double fCalibrate;
+		SetupTime() : fOpen(0.), fProgram(0.), fAllocate(0.), fCalibrate(0.) {}
+	};
+	std::vector<SetupTime> fSetupTime;
 
 	bool fDebug;
 };
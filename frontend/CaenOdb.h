@@ -33,6 +33,17 @@ typedef struct {
   WORD      channels_per_digitizer;
   BOOL		use_external_clock;
   BOOL      raw_output;
+  BOOL      threaded_readout;
+  WORD      ring_buffer_slots;
+  BOOL      zero_copy;
+  DWORD     raw_output_file_size;
+  WORD      raw_output_queue_size;
+  BOOL      raw_output_direct_io;
+  BOOL      use_interrupts;
+  WORD      irq_level;
+  WORD      events_per_interrupt;
+  WORD      irq_timeout;
+  BOOL      parallel_setup;
   WORD      link_type;
   WORD		board_type;
   DWORD     vme_base_address;
@@ -80,6 +91,17 @@ typedef struct {
 	"Channels per digitizer = WORD : 8",\
 	"Use external clock = BOOL : 0",\
 	"Raw output = BOOL : 0",\
+	"Threaded readout = BOOL : 0",\
+	"Ring buffer slots = WORD : 8",\
+	"Zero copy readout = BOOL : 1",\
+	"Raw output file size (MB) = DWORD : 2000",\
+	"Raw output queue size (MB) = WORD : 256",\
+	"Raw output direct IO = BOOL : 0",\
+	"Use interrupts = BOOL : 0",\
+	"IRQ level = WORD : 1",\
+	"Events per interrupt = WORD : 1",\
+	"IRQ timeout (ms) = WORD : 100",\
+	"Parallel setup = BOOL : 1",\
 	"Link Type = WORD : 1",\
 	"Board Type = WORD : 2",\
 	"VME base address = DWORD : 0",\
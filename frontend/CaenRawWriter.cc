@@ -0,0 +1,233 @@
+#include "CaenRawWriter.hh"
+
+#include <iostream>
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <cerrno>
+#include <new>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "midas.h"
+
+CaenRawWriter::CaenRawWriter(size_t queueSize, size_t maxFileSize, bool directIO, bool debug)
+	: fStop(false), fCurrent(nullptr), fFileBytes(0), fNewFile(false), fBytesDropped(0), fFile(-1), fRunNumber(0), fSubRun(0), fBytesWritten(0),
+	  fMaxFileSize(maxFileSize), fDirectIO(directIO), fDebug(debug)
+{
+	size_t nofChunks = queueSize/fChunkSize;
+	if(nofChunks < 2) nofChunks = 2;
+	fChunks.resize(nofChunks);
+	for(auto& chunk : fChunks) {
+		// page aligned, as required for O_DIRECT
+		void* data = nullptr;
+		if(posix_memalign(&data, 4096, fChunkSize) != 0) {
+			for(auto& allocated : fChunks) {
+				free(allocated.fData);
+			}
+			throw std::bad_alloc();
+		}
+		chunk.fData = static_cast<char*>(data);
+		chunk.fSize = 0;
+		chunk.fNewFile = false;
+	}
+	if(fDebug) std::cout<<"allocated "<<fChunks.size()<<" chunks of "<<fChunkSize<<" bytes for raw output"<<std::endl;
+}
+
+CaenRawWriter::~CaenRawWriter()
+{
+	Close();
+	for(auto& chunk : fChunks) {
+		free(chunk.fData);
+	}
+}
+
+bool CaenRawWriter::Open(int runNumber)
+{
+	Close();
+	fRunNumber = runNumber;
+	fSubRun = 0;
+	if(!OpenFile()) {
+		return false;
+	}
+	fFree.clear();
+	fFilled.clear();
+	for(auto& chunk : fChunks) {
+		fFree.push_back(&chunk);
+	}
+	fCurrent = nullptr;
+	fFileBytes = 0;
+	fNewFile = false;
+	fBytesDropped = 0;
+	fBytesWritten = 0;
+	fStop = false;
+	fThread = std::thread(&CaenRawWriter::WriterLoop, this);
+
+	return true;
+}
+
+void CaenRawWriter::Close()
+{
+	if(!IsOpen()) return;
+	// hand over the last (partial) chunk and let the thread write everything that is left
+	if(fCurrent != nullptr) {
+		if(fCurrent->fSize > 0) {
+			Push();
+		} else {
+			std::lock_guard<std::mutex> lock(fMutex);
+			fFree.push_back(fCurrent);
+			fCurrent = nullptr;
+		}
+	}
+	{
+		std::lock_guard<std::mutex> lock(fMutex);
+		fStop = true;
+	}
+	fCondition.notify_one();
+	fThread.join();
+	CloseFile();
+	if(fBytesDropped > 0) {
+		cm_msg(MERROR, "CaenRawWriter", "Dropped %llu bytes of raw output because the queue was full", static_cast<unsigned long long>(fBytesDropped));
+	}
+}
+
+void CaenRawWriter::Write(const char* data, size_t size)
+{
+	if(!IsOpen() || size == 0) return;
+
+	// start a new file if this data doesn't fit into the current one anymore
+	if(fFileBytes > 0 && fFileBytes + size > fMaxFileSize) {
+		if(fCurrent != nullptr) {
+			Push();
+		}
+		fNewFile = true;
+		fFileBytes = 0;
+	}
+
+	// check that we have enough free chunks for all the data, if not we drop it instead of waiting
+	size_t space = (fCurrent != nullptr) ? fChunkSize - fCurrent->fSize : 0;
+	size_t needed = (size > space) ? (size - space + fChunkSize - 1)/fChunkSize : 0;
+	{
+		std::lock_guard<std::mutex> lock(fMutex);
+		if(fFree.size() < needed) {
+			fBytesDropped += size;
+			return;
+		}
+	}
+
+	fFileBytes += size;
+	while(size > 0) {
+		if(fCurrent == nullptr) {
+			std::lock_guard<std::mutex> lock(fMutex);
+			fCurrent = fFree.front();
+			fFree.pop_front();
+			fCurrent->fSize = 0;
+			fCurrent->fNewFile = fNewFile;
+			fNewFile = false;
+		}
+		size_t n = std::min(size, fChunkSize - fCurrent->fSize);
+		std::memcpy(fCurrent->fData + fCurrent->fSize, data, n);
+		fCurrent->fSize += n;
+		data += n;
+		size -= n;
+		if(fCurrent->fSize == fChunkSize) {
+			Push();
+		}
+	}
+}
+
+size_t CaenRawWriter::QueueDepth()
+{
+	std::lock_guard<std::mutex> lock(fMutex);
+	return fFilled.size();
+}
+
+void CaenRawWriter::Push()
+{
+	{
+		std::lock_guard<std::mutex> lock(fMutex);
+		fFilled.push_back(fCurrent);
+	}
+	fCurrent = nullptr;
+	fCondition.notify_one();
+}
+
+void CaenRawWriter::WriterLoop()
+{
+	while(true) {
+		Chunk* chunk;
+		{
+			std::unique_lock<std::mutex> lock(fMutex);
+			fCondition.wait(lock, [this] { return fStop || !fFilled.empty(); });
+			if(fFilled.empty()) break; // stop requested and everything has been written
+			chunk = fFilled.front();
+			fFilled.pop_front();
+		}
+		if(chunk->fNewFile) {
+			CloseFile();
+			++fSubRun;
+			OpenFile();
+		}
+		WriteChunk(chunk);
+		{
+			std::lock_guard<std::mutex> lock(fMutex);
+			fFree.push_back(chunk);
+		}
+	}
+}
+
+void CaenRawWriter::WriteChunk(const Chunk* chunk)
+{
+	if(fFile < 0) return;
+
+	// with O_DIRECT only multiples of the page size can be written, this is true for all full chunks
+	// a partial chunk is always the last one of a file, so we can switch O_DIRECT off for its tail
+	size_t aligned = fDirectIO ? (chunk->fSize & ~static_cast<size_t>(4095)) : chunk->fSize;
+	size_t written = 0;
+	while(written < chunk->fSize) {
+		if(written == aligned) {
+			fcntl(fFile, F_SETFL, fcntl(fFile, F_GETFL) & ~O_DIRECT);
+			aligned = chunk->fSize;
+		}
+		ssize_t result = write(fFile, chunk->fData + written, aligned - written);
+		if(result < 0) {
+			if(errno == EINTR) continue;
+			cm_msg(MERROR, "CaenRawWriter", "Failed to write raw output of run %d, sub-run %d: %s", fRunNumber, fSubRun, strerror(errno));
+			CloseFile();
+			return;
+		}
+		written += result;
+	}
+	fBytesWritten += chunk->fSize;
+}
+
+bool CaenRawWriter::OpenFile()
+{
+	char fileName[64];
+	snprintf(fileName, sizeof(fileName), "run%05d_%03d.dat", fRunNumber, fSubRun);
+	int flags = O_WRONLY | O_CREAT | O_TRUNC;
+	if(fDirectIO) {
+		fFile = open(fileName, flags | O_DIRECT, 0644);
+		if(fFile >= 0) {
+			if(fDebug) std::cout<<"opened raw output file "<<fileName<<" with O_DIRECT"<<std::endl;
+			return true;
+		}
+		// not all file systems support direct I/O
+		cm_msg(MINFO, "CaenRawWriter", "Failed to open %s with O_DIRECT (%s), using buffered I/O", fileName, strerror(errno));
+		fDirectIO = false;
+	}
+	fFile = open(fileName, flags, 0644);
+	if(fFile < 0) {
+		cm_msg(MERROR, "CaenRawWriter", "Failed to open raw output file %s: %s", fileName, strerror(errno));
+		return false;
+	}
+	if(fDebug) std::cout<<"opened raw output file "<<fileName<<std::endl;
+	return true;
+}
+
+void CaenRawWriter::CloseFile()
+{
+	if(fFile < 0) return;
+	close(fFile);
+	fFile = -1;
+}
@@ -0,0 +1,75 @@
+#ifndef CAENRAWWRITER_HH
+#define CAENRAWWRITER_HH
+#include <string>
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <cstdint>
+
+// writes the raw readout data to disk from a background thread
+// data is collected in large page-aligned chunks, full chunks are queued and written by the thread
+// if the queue is full the data is dropped (and counted) instead of stalling the readout
+// files are named run<run number>_<sub-run>.dat and a new one is started once the maximum size would be exceeded
+class CaenRawWriter {
+public:
+	CaenRawWriter(size_t queueSize, size_t maxFileSize, bool directIO, bool debug = false);
+	~CaenRawWriter();
+
+	bool Open(int runNumber);
+	void Close();
+	bool IsOpen() const { return fThread.joinable(); }
+
+	// copies size bytes from data into the current chunk, the data of one call is never split across files
+	void Write(const char* data, size_t size);
+
+	size_t QueueDepth();
+	size_t QueueSize() const { return fChunks.size(); }
+	uint64_t BytesWritten() const { return fBytesWritten.load(); }
+	uint64_t BytesDropped() const { return fBytesDropped; }
+
+private:
+	struct Chunk {
+		char*  fData;
+		size_t fSize;    // bytes used
+		bool   fNewFile; // this chunk is the first one of a new file
+	};
+
+	CaenRawWriter(const CaenRawWriter&) = delete;
+	CaenRawWriter& operator=(const CaenRawWriter&) = delete;
+
+	void WriterLoop();
+	bool OpenFile();
+	void CloseFile();
+	void WriteChunk(const Chunk* chunk);
+	void Push();
+
+	static const size_t fChunkSize = 4*1024*1024;
+
+	std::vector<Chunk> fChunks;
+	std::deque<Chunk*> fFree;   // chunks available to the producer
+	std::deque<Chunk*> fFilled; // chunks waiting to be written
+	std::mutex fMutex;
+	std::condition_variable fCondition;
+	std::thread fThread;
+	bool fStop;
+
+	// producer side
+	Chunk* fCurrent;
+	size_t fFileBytes; // bytes written to the current file (incl. chunks still queued)
+	bool fNewFile;     // the next chunk starts a new file
+	uint64_t fBytesDropped;
+
+	// writer side
+	int fFile;
+	int fRunNumber;
+	int fSubRun;
+	std::atomic<uint64_t> fBytesWritten;
+
+	size_t fMaxFileSize;
+	bool fDirectIO;
+	bool fDebug;
+};
+#endif
@@ -0,0 +1,77 @@
+#include "CaenRegisterCache.hh"
+
+#include "CAENDigitizer.h"
+
+int CaenRegisterCache::Read(uint32_t address, uint32_t& value)
+{
+	++fUncached;
+	Register& reg = fRegisters[address];
+	if(!reg.fKnown) {
+		int errorCode = CAEN_DGTZ_ReadRegister(fHandle, address, &reg.fValue);
+		++fReads;
+		if(errorCode != 0) return errorCode;
+		reg.fKnown = true;
+	}
+	value = (reg.fValue & ~reg.fMask) | (reg.fPending & reg.fMask);
+	return 0;
+}
+
+void CaenRegisterCache::Modify(uint32_t address, uint32_t mask, uint32_t value)
+{
+	// a plain read-modify-write would need two accesses (one for a full write)
+	fUncached += (mask == 0xffffffff) ? 1 : 2;
+	Register& reg = fRegisters[address];
+	if(reg.fMask == 0) fModified.push_back(address);
+	reg.fMask    |= mask;
+	reg.fPending  = (reg.fPending & ~mask) | (value & mask);
+}
+
+int CaenRegisterCache::Flush()
+{
+	int result = 0;
+	for(uint32_t address : fModified) {
+		Register& reg = fRegisters[address];
+		if(reg.fMask == 0) continue;
+		int errorCode = 0;
+		if(address == 0x8000 && !reg.fKnown && (reg.fPending & reg.fMask) == reg.fMask) {
+			// only bits to set in the board configuration, we can use its bit-set register without reading it
+			errorCode = CAEN_DGTZ_WriteRegister(fHandle, 0x8004, reg.fMask);
+			++fWrites;
+		} else if(address == 0x8000 && !reg.fKnown && (reg.fPending & reg.fMask) == 0) {
+			// only bits to clear, same with the bit-clear register
+			errorCode = CAEN_DGTZ_WriteRegister(fHandle, 0x8008, reg.fMask);
+			++fWrites;
+		} else {
+			if(!reg.fKnown && reg.fMask != 0xffffffff) {
+				errorCode = CAEN_DGTZ_ReadRegister(fHandle, address, &reg.fValue);
+				++fReads;
+			}
+			if(errorCode == 0) {
+				reg.fValue = (reg.fValue & ~reg.fMask) | (reg.fPending & reg.fMask);
+				errorCode = CAEN_DGTZ_WriteRegister(fHandle, address, reg.fValue);
+				++fWrites;
+			}
+			// if reading or writing failed we don't know what's in the board, the modification is dropped like
+			// all others (fModified is cleared), the error is returned, so the board gets programmed from scratch again
+			reg.fKnown = (errorCode == 0);
+		}
+		if(errorCode != 0 && result == 0) result = errorCode;
+		reg.fMask = 0;
+		reg.fPending = 0;
+	}
+	fModified.clear();
+	return result;
+}
+
+void CaenRegisterCache::Invalidate()
+{
+	for(auto& reg : fRegisters) {
+		reg.second.fKnown = false;
+	}
+}
+
+void CaenRegisterCache::Clear()
+{
+	fRegisters.clear();
+	fModified.clear();
+}
@@ -0,0 +1,54 @@
+#ifndef CAENREGISTERCACHE_HH
+#define CAENREGISTERCACHE_HH
+#include <map>
+#include <vector>
+#include <cstdint>
+
+// shadow copy of the registers of one board
+// modifications of bit-fields are collected and written with a single write per register when flushed,
+// the register is only read if we don't know its current contents (and the whole register isn't overwritten)
+// any library call that might write registers itself has to be followed by Invalidate()
+// all accesses to the board are counted, as well as the accesses plain read-modify-write cycles would have needed
+class CaenRegisterCache {
+public:
+	CaenRegisterCache() : fHandle(-1), fReads(0), fWrites(0), fUncached(0) {}
+
+	// sets the handle of the board, this forgets everything we knew about the registers
+	void Handle(int handle) { fHandle = handle; Clear(); }
+
+	// reads the register, from the board only if the contents aren't known
+	int Read(uint32_t address, uint32_t& value);
+	// sets the bits in mask to value, the register is only written by Flush()
+	void Modify(uint32_t address, uint32_t mask, uint32_t value);
+	void Write(uint32_t address, uint32_t value) { Modify(address, 0xffffffff, value); }
+	// writes all modified registers in the order they were first modified, returns the first error
+	int Flush();
+
+	// forget the contents of the registers (but not the pending modifications)
+	void Invalidate();
+	// forget everything, e.g. after a reset
+	void Clear();
+
+	uint64_t Reads() const { return fReads; }
+	uint64_t Writes() const { return fWrites; }
+	uint64_t RoundTrips() const { return fReads + fWrites; }
+	uint64_t UncachedRoundTrips() const { return fUncached; }
+	void ResetCounters() { fReads = 0; fWrites = 0; fUncached = 0; }
+
+private:
+	struct Register {
+		bool     fKnown;   // fValue is what's in the board (apart from pending bits)
+		uint32_t fValue;
+		uint32_t fMask;    // bits modified since the last flush
+		uint32_t fPending; // new value of those bits
+	};
+
+	int fHandle;
+	std::map<uint32_t, Register> fRegisters;
+	std::vector<uint32_t> fModified;
+
+	uint64_t fReads;
+	uint64_t fWrites;
+	uint64_t fUncached;
+};
+#endif
@@ -0,0 +1,29 @@
+#include "CaenRingBuffer.hh"
+
+#include <cstdlib>
+#include <new>
+
+CaenRingBuffer::CaenRingBuffer(size_t nofSlots, uint32_t slotSize)
+	: fSlotSize(slotSize), fHead(0), fTail(0)
+{
+	fSlots.resize(nofSlots);
+	for(auto& slot : fSlots) {
+		// page aligned so the blocks can be used for DMA and direct I/O
+		void* data = nullptr;
+		if(posix_memalign(&data, 4096, fSlotSize) != 0) {
+			for(auto& allocated : fSlots) {
+				free(allocated.fData);
+			}
+			throw std::bad_alloc();
+		}
+		slot.fData = static_cast<char*>(data);
+		slot.fSize = 0;
+	}
+}
+
+CaenRingBuffer::~CaenRingBuffer()
+{
+	for(auto& slot : fSlots) {
+		free(slot.fData);
+	}
+}
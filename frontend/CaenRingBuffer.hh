@@ -0,0 +1,60 @@
+#ifndef CAENRINGBUFFER_HH
+#define CAENRINGBUFFER_HH
+#include <atomic>
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+
+// single-producer/single-consumer ring of preallocated readout blocks
+// the producer (readout thread of one board) fills the slot returned by WriteSlot() and hands it over with CommitWrite()
+// the consumer (MIDAS readout) takes the oldest filled slot from ReadSlot() and releases it with CommitRead()
+// no locks are used, head and tail are only ever modified by one side each
+class CaenRingBuffer {
+public:
+	struct Slot {
+		char*    fData;
+		uint32_t fSize; // number of bytes used
+	};
+
+	CaenRingBuffer(size_t nofSlots, uint32_t slotSize);
+	~CaenRingBuffer();
+
+	// producer side
+	Slot* WriteSlot() {
+		size_t head = fHead.load(std::memory_order_relaxed);
+		if(head - fTail.load(std::memory_order_acquire) >= fSlots.size()) return nullptr; // full
+		return &fSlots[head%fSlots.size()];
+	}
+	void CommitWrite() { fHead.fetch_add(1, std::memory_order_release); }
+
+	// consumer side
+	Slot* ReadSlot() {
+		size_t tail = fTail.load(std::memory_order_relaxed);
+		if(tail == fHead.load(std::memory_order_acquire)) return nullptr; // empty
+		return &fSlots[tail%fSlots.size()];
+	}
+	void CommitRead() { fTail.fetch_add(1, std::memory_order_release); }
+
+	bool Empty() const { return fTail.load(std::memory_order_acquire) == fHead.load(std::memory_order_acquire); }
+	size_t Used() const { return fHead.load(std::memory_order_acquire) - fTail.load(std::memory_order_acquire); }
+	size_t NumberOfSlots() const { return fSlots.size(); }
+	uint32_t SlotSize() const { return fSlotSize; }
+
+	// only call this if neither producer nor consumer are active
+	void Reset() { fHead.store(0); fTail.store(0); }
+
+private:
+	CaenRingBuffer(const CaenRingBuffer&) = delete;
+	CaenRingBuffer& operator=(const CaenRingBuffer&) = delete;
+
+	std::vector<Slot> fSlots;
+	uint32_t fSlotSize;
+
+	// keep head and tail on separate cache lines so producer and consumer don't fight over them
+	// (padding instead of alignas, as over-aligned new is only available from C++17 on)
+	char fPadding0[64];
+	std::atomic<size_t> fHead; // next slot to be written
+	char fPadding1[64];
+	std::atomic<size_t> fTail; // next slot to be read
+};
+#endif
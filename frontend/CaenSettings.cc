@@ -112,6 +112,16 @@ ChannelSettings::~ChannelSettings()
 {
 }
 
+bool ChannelSettings::operator==(const ChannelSettings& rhs) const
+{
+	return fRecordLength == rhs.fRecordLength &&
+		fDCOffset == rhs.fDCOffset &&
+		fPreTrigger == rhs.fPreTrigger &&
+		fPulsePolarity == rhs.fPulsePolarity &&
+		fEnableCfd == rhs.fEnableCfd &&
+		fCfdParameters == rhs.fCfdParameters;
+}
+
 void ChannelSettings::Print()
 {
 	std::cout<<"      record length "<<fRecordLength<<std::endl;
@@ -327,6 +337,37 @@ BoardSettings::~BoardSettings()
 {
 }
 
+bool BoardSettings::SameBoardSettings(const BoardSettings& rhs) const
+{
+	if(fLinkType != rhs.fLinkType || fBoardType != rhs.fBoardType || fVmeBaseAddress != rhs.fVmeBaseAddress ||
+		fPortNumber != rhs.fPortNumber || fDeviceNumber != rhs.fDeviceNumber ||
+		fAcquisitionMode != rhs.fAcquisitionMode || fIOLevel != rhs.fIOLevel || fChannelMask != rhs.fChannelMask ||
+		fRunSync != rhs.fRunSync || fEventAggregation != rhs.fEventAggregation || fTriggerMode != rhs.fTriggerMode ||
+		fChannelSettings.size() != rhs.fChannelSettings.size()) {
+		return false;
+	}
+	// the DPP parameters aren't all set (e.g. for channels beyond the number of channels), so we can't just compare the memory
+	if(fChannelParameter.purh != rhs.fChannelParameter.purh || fChannelParameter.purgap != rhs.fChannelParameter.purgap ||
+		fChannelParameter.blthr != rhs.fChannelParameter.blthr || fChannelParameter.bltmo != rhs.fChannelParameter.bltmo ||
+		fChannelParameter.trgho != rhs.fChannelParameter.trgho) {
+		return false;
+	}
+	for(size_t ch = 0; ch < fChannelSettings.size(); ++ch) {
+		if(fChannelParameter.thr[ch] != rhs.fChannelParameter.thr[ch] ||
+			fChannelParameter.nsbl[ch] != rhs.fChannelParameter.nsbl[ch] ||
+			fChannelParameter.lgate[ch] != rhs.fChannelParameter.lgate[ch] ||
+			fChannelParameter.sgate[ch] != rhs.fChannelParameter.sgate[ch] ||
+			fChannelParameter.pgate[ch] != rhs.fChannelParameter.pgate[ch] ||
+			fChannelParameter.selft[ch] != rhs.fChannelParameter.selft[ch] ||
+			fChannelParameter.trgc[ch] != rhs.fChannelParameter.trgc[ch] ||
+			fChannelParameter.tvaw[ch] != rhs.fChannelParameter.tvaw[ch] ||
+			fChannelParameter.csens[ch] != rhs.fChannelParameter.csens[ch]) {
+			return false;
+		}
+	}
+	return true;
+}
+
 void BoardSettings::Print()
 {
 	std::cout<<"  link type "<<fLinkType<<" = ";
@@ -505,6 +546,25 @@ void CaenSettings::ReadOdb(HNDLE hDB)
 	}
 	fUseExternalClock = templateSettings.use_external_clock;
 	fRawOutput = templateSettings.raw_output;
+	fThreadedReadout = templateSettings.threaded_readout;
+	fRingBufferSlots = templateSettings.ring_buffer_slots;
+	if(fRingBufferSlots < 2) {
+		std::cout<<fRingBufferSlots<<" ring buffer slots is not possible, using 2 instead!"<<std::endl;
+		fRingBufferSlots = 2;
+	}
+	fZeroCopy = templateSettings.zero_copy;
+	fRawOutputFileSize = static_cast<size_t>(templateSettings.raw_output_file_size)*1024*1024;
+	fRawOutputQueueSize = static_cast<size_t>(templateSettings.raw_output_queue_size)*1024*1024;
+	fRawOutputDirectIO = templateSettings.raw_output_direct_io;
+	fUseInterrupts = templateSettings.use_interrupts;
+	fIrqLevel = templateSettings.irq_level;
+	if(fIrqLevel < 1 || fIrqLevel > 7) {
+		std::cout<<static_cast<int>(fIrqLevel)<<" is not a valid IRQ level, using 1 instead!"<<std::endl;
+		fIrqLevel = 1;
+	}
+	fEventsPerInterrupt = templateSettings.events_per_interrupt;
+	fIrqTimeout = templateSettings.irq_timeout;
+	fParallelSetup = templateSettings.parallel_setup;
 	fBufferSize = 100000;
 
 	if(fDebug) {
@@ -513,6 +573,17 @@ void CaenSettings::ReadOdb(HNDLE hDB)
 			<<"number_of_digitizer "<<templateSettings.number_of_digitizers<<std::endl
 			<<"channels_per_digitizer "<<templateSettings.channels_per_digitizer<<std::endl
 			<<"raw_output "<<templateSettings.raw_output<<std::endl
+			<<"threaded_readout "<<templateSettings.threaded_readout<<std::endl
+			<<"ring_buffer_slots "<<templateSettings.ring_buffer_slots<<std::endl
+			<<"zero_copy "<<templateSettings.zero_copy<<std::endl
+			<<"raw_output_file_size "<<templateSettings.raw_output_file_size<<std::endl
+			<<"raw_output_queue_size "<<templateSettings.raw_output_queue_size<<std::endl
+			<<"raw_output_direct_io "<<templateSettings.raw_output_direct_io<<std::endl
+			<<"use_interrupts "<<templateSettings.use_interrupts<<std::endl
+			<<"irq_level "<<templateSettings.irq_level<<std::endl
+			<<"events_per_interrupt "<<templateSettings.events_per_interrupt<<std::endl
+			<<"irq_timeout "<<templateSettings.irq_timeout<<std::endl
+			<<"parallel_setup "<<templateSettings.parallel_setup<<std::endl
 			<<"link_type "<<templateSettings.link_type<<std::endl
 			<<"vme_base_address "<<templateSettings.vme_base_address<<std::endl
 			<<"acquisition_mode "<<templateSettings.acquisition_mode<<std::endl
@@ -543,6 +614,7 @@ void CaenSettings::ReadOdb(HNDLE hDB)
 			<<std::endl;
 	}
 	fBoardSettings.resize(fNumberOfBoards);
+	fProgrammed.resize(fNumberOfBoards);
 	for(int i = 0; i < fNumberOfBoards; ++i) {
 		fBoardSettings[i] = BoardSettings(fNumberOfChannels, templateSettings);
 		fBoardSettings[i].PortNumber(i); //this might get overwritten by custom settings
@@ -599,8 +671,20 @@ bool CaenSettings::ReadSettingsFile(const std::string& filename)
 	}
 	fUseExternalClock = settings->GetValue("UseExternalClocl", false);
 	fBufferSize = settings->GetValue("BufferSize", 100000);
+	fThreadedReadout = settings->GetValue("ThreadedReadout", false);
+	fRingBufferSlots = settings->GetValue("RingBufferSlots", 8);
+	fZeroCopy = settings->GetValue("ZeroCopy", true);
+	fRawOutputFileSize = static_cast<size_t>(settings->GetValue("RawOutputFileSize", 2000))*1024*1024;
+	fRawOutputQueueSize = static_cast<size_t>(settings->GetValue("RawOutputQueueSize", 256))*1024*1024;
+	fRawOutputDirectIO = settings->GetValue("RawOutputDirectIO", false);
+	fUseInterrupts = settings->GetValue("UseInterrupts", false);
+	fIrqLevel = settings->GetValue("IrqLevel", 1);
+	fEventsPerInterrupt = settings->GetValue("EventsPerInterrupt", 1);
+	fIrqTimeout = settings->GetValue("IrqTimeout", 100);
+	fParallelSetup = settings->GetValue("ParallelSetup", true);
 
 	fBoardSettings.resize(fNumberOfBoards);
+	fProgrammed.resize(fNumberOfBoards);
 	for(int i = 0; i < fNumberOfBoards; ++i) {
 		fBoardSettings[i] = BoardSettings(i, fNumberOfChannels, settings);
 	}
@@ -627,6 +711,17 @@ bool CaenSettings::WriteOdb()
 	script<<"odbedit -c \"set \\\"/DAQ/params/VX1730/custom/Channels per digitizer\\\" "<<fNumberOfChannels<<"\""<<std::endl;
 	script<<"odbedit -c \"set \\\"/DAQ/params/VX1730/custom/Use external clock\\\" "<<fUseExternalClock<<"\""<<std::endl;
 	script<<"odbedit -c \"set \\\"/DAQ/params/VX1730/custom/Raw output\\\" "<<fRawOutput<<"\""<<std::endl;
+	script<<"odbedit -c \"set \\\"/DAQ/params/VX1730/custom/Threaded readout\\\" "<<fThreadedReadout<<"\""<<std::endl;
+	script<<"odbedit -c \"set \\\"/DAQ/params/VX1730/custom/Ring buffer slots\\\" "<<fRingBufferSlots<<"\""<<std::endl;
+	script<<"odbedit -c \"set \\\"/DAQ/params/VX1730/custom/Zero copy readout\\\" "<<fZeroCopy<<"\""<<std::endl;
+	script<<"odbedit -c \"set \\\"/DAQ/params/VX1730/custom/Raw output file size (MB)\\\" "<<fRawOutputFileSize/(1024*1024)<<"\""<<std::endl;
+	script<<"odbedit -c \"set \\\"/DAQ/params/VX1730/custom/Raw output queue size (MB)\\\" "<<fRawOutputQueueSize/(1024*1024)<<"\""<<std::endl;
+	script<<"odbedit -c \"set \\\"/DAQ/params/VX1730/custom/Raw output direct IO\\\" "<<fRawOutputDirectIO<<"\""<<std::endl;
+	script<<"odbedit -c \"set \\\"/DAQ/params/VX1730/custom/Use interrupts\\\" "<<fUseInterrupts<<"\""<<std::endl;
+	script<<"odbedit -c \"set \\\"/DAQ/params/VX1730/custom/IRQ level\\\" "<<static_cast<int>(fIrqLevel)<<"\""<<std::endl;
+	script<<"odbedit -c \"set \\\"/DAQ/params/VX1730/custom/Events per interrupt\\\" "<<fEventsPerInterrupt<<"\""<<std::endl;
+	script<<"odbedit -c \"set \\\"/DAQ/params/VX1730/custom/IRQ timeout (ms)\\\" "<<fIrqTimeout<<"\""<<std::endl;
+	script<<"odbedit -c \"set \\\"/DAQ/params/VX1730/custom/Parallel setup\\\" "<<fParallelSetup<<"\""<<std::endl;
 	//script<<"odbedit -c \"set \\\"/DAQ/params/VX1730/custom/Link Type\\\" "<<fLinkType<<"\""<<std::endl;
 	//script<<"odbedit -c \"set \\\"/DAQ/params/VX1730/custom/VME base address\\\" "<<fVmeBaseAddress<<"\""<<std::endl;
 	//script<<"odbedit -c \"set \\\"/DAQ/params/VX1730/custom/Acquisition Mode\\\" "<<fAcquisitionMode<<"\""<<std::endl;
@@ -731,6 +826,17 @@ bool CaenSettings::WriteOdb()
 	//	settings.charge_sensitivity[ch] = fChannelParameter.csens[ch];
 	//}
 	settings.raw_output = fRawOutput;
+	settings.threaded_readout = fThreadedReadout;
+	settings.ring_buffer_slots = fRingBufferSlots;
+	settings.zero_copy = fZeroCopy;
+	settings.raw_output_file_size = fRawOutputFileSize/(1024*1024);
+	settings.raw_output_queue_size = fRawOutputQueueSize/(1024*1024);
+	settings.raw_output_direct_io = fRawOutputDirectIO;
+	settings.use_interrupts = fUseInterrupts;
+	settings.irq_level = fIrqLevel;
+	settings.events_per_interrupt = fEventsPerInterrupt;
+	settings.irq_timeout = fIrqTimeout;
+	settings.parallel_setup = fParallelSetup;
 	std::cout<<"connecting to database ..."<<std::endl;
 	// connect to ODB
 	if(cm_get_experiment_database(&hDB, NULL) != CM_SUCCESS) {
@@ -758,9 +864,71 @@ bool CaenSettings::WriteOdb()
 	return true;
 }
 
+void CaenSettings::Programmed(int board)
+{
+	// this is called from the setup threads (one per board), so it only touches the entry of this board
+	ProgrammedSettings& programmed = fProgrammed.at(board);
+	programmed.fBoardSettings      = fBoardSettings.at(board);
+	programmed.fUseExternalClock   = fUseExternalClock;
+	programmed.fUseInterrupts      = fUseInterrupts;
+	programmed.fIrqLevel           = fIrqLevel;
+	programmed.fEventsPerInterrupt = fEventsPerInterrupt;
+	programmed.fValid              = true;
+}
+
+void CaenSettings::ForgetProgrammed(int board)
+{
+	fProgrammed.at(board).fValid = false;
+}
+
+bool CaenSettings::ResetNeeded(int board) const
+{
+	// changes that affect the memory organisation of the board (acquisition mode, channel mask, aggregation, record length),
+	// the connection, or settings that are only ever enabled (external clock, interrupts) need a reset and full programming
+	const ProgrammedSettings& programmed = fProgrammed.at(board);
+	if(!programmed.fValid) return true;
+	const BoardSettings& last = programmed.fBoardSettings;
+	const BoardSettings& current = fBoardSettings.at(board);
+	if(last.NumberOfChannels() != current.NumberOfChannels() ||
+		last.LinkType() != current.LinkType() || last.BoardType() != current.BoardType() ||
+		last.VmeBaseAddress() != current.VmeBaseAddress() || last.PortNumber() != current.PortNumber() || last.DeviceNumber() != current.DeviceNumber() ||
+		last.AcquisitionMode() != current.AcquisitionMode() || last.ChannelMask() != current.ChannelMask() ||
+		last.EventAggregation() != current.EventAggregation() || last.RunSync() != current.RunSync()) {
+		return true;
+	}
+	if(programmed.fUseExternalClock != fUseExternalClock || programmed.fUseInterrupts != fUseInterrupts ||
+		programmed.fIrqLevel != fIrqLevel || programmed.fEventsPerInterrupt != fEventsPerInterrupt) {
+		return true;
+	}
+	for(size_t ch = 0; ch < current.NumberOfChannels(); ++ch) {
+		if(last.RecordLength(ch) != current.RecordLength(ch)) return true;
+	}
+	return false;
+}
+
+bool CaenSettings::BoardChanged(int board) const
+{
+	const ProgrammedSettings& programmed = fProgrammed.at(board);
+	if(!programmed.fValid) return true;
+	return !programmed.fBoardSettings.SameBoardSettings(fBoardSettings.at(board));
+}
+
+bool CaenSettings::ChannelChanged(int board, int channel) const
+{
+	const ProgrammedSettings& programmed = fProgrammed.at(board);
+	if(!programmed.fValid) return true;
+	return programmed.fBoardSettings.Channel(channel) != fBoardSettings.at(board).Channel(channel);
+}
+
 void CaenSettings::Print()
 {
 	std::cout<<(fUseExternalClock?"Using ":"Not using ")<<" external clock for "<<fNumberOfBoards<<" board(s) with "<<fNumberOfChannels<<" channels each:"<<std::endl;
+	if(fThreadedReadout) {
+		std::cout<<"Threaded readout with "<<fRingBufferSlots<<" ring buffer slots per board"<<std::endl;
+	}
+	if(fUseInterrupts) {
+		std::cout<<"Using interrupts on level "<<static_cast<int>(fIrqLevel)<<" every "<<fEventsPerInterrupt<<" event(s), timeout "<<fIrqTimeout<<" ms"<<std::endl;
+	}
 	for(size_t i = 0; i < fBoardSettings.size(); ++i) {
 		std::cout<<"Board #"<<i<<std::endl;
 		fBoardSettings[i].Print();
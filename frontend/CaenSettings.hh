@@ -24,6 +24,10 @@ public:
 	void ReadCustomSettings(const HNDLE& db, const HNDLE& key);
 	void Print();
 
+	// compares the settings that are programmed into the board (coincidences aren't programmed yet)
+	bool operator==(const ChannelSettings& rhs) const;
+	bool operator!=(const ChannelSettings& rhs) const { return !(*this == rhs); }
+
 	//setters
 	void RecordLength(const uint32_t& val) { fRecordLength = val; }
 	void DCOffset(const uint32_t& val) { fDCOffset = val; }
@@ -77,6 +81,11 @@ public:
 
 	void Print();
 
+	// compares the board-wide settings (incl. the DPP parameters of all channels), not the channel settings
+	bool SameBoardSettings(const BoardSettings& rhs) const;
+	size_t NumberOfChannels() const { return fChannelSettings.size(); }
+	const ChannelSettings& Channel(const int& i) const { return fChannelSettings.at(i); }
+
 	//setters
 	void LinkType(const CAEN_DGTZ_ConnectionType& val) { fLinkType = val; }
 	void BoardType(const EBoardType& val) { fBoardType = val; }
@@ -193,6 +202,28 @@ public:
 	size_t BufferSize() const { return fBufferSize; }
 
 	bool RawOutput() const { return fRawOutput; }
+	size_t RawOutputFileSize() const { return fRawOutputFileSize; }
+	size_t RawOutputQueueSize() const { return fRawOutputQueueSize; }
+	bool RawOutputDirectIO() const { return fRawOutputDirectIO; }
+
+	bool UseInterrupts() const { return fUseInterrupts; }
+	uint8_t IrqLevel() const { return fIrqLevel; }
+	uint16_t EventsPerInterrupt() const { return fEventsPerInterrupt; }
+	uint32_t IrqTimeout() const { return fIrqTimeout; }
+
+	bool ParallelSetup() const { return fParallelSetup; }
+
+	// keeps track of the settings each board was last programmed with, so only changes need to be written
+	void Programmed(int board);
+	void ForgetProgrammed(int board);
+	bool ResetNeeded(int board) const;
+	bool BoardChanged(int board) const;
+	bool ChannelChanged(int board, int channel) const;
+	const BoardSettings& LastProgrammed(int board) const { return fProgrammed.at(board).fBoardSettings; }
+
+	bool ThreadedReadout() const { return fThreadedReadout; }
+	int RingBufferSlots() const { return fRingBufferSlots; }
+	bool ZeroCopy() const { return fZeroCopy; }
 
 private:
 	int fNumberOfBoards;
@@ -204,6 +235,32 @@ private:
 	size_t fBufferSize;
 
 	bool fRawOutput;
+	size_t fRawOutputFileSize;  // in bytes
+	size_t fRawOutputQueueSize; // in bytes
+	bool fRawOutputDirectIO;
+
+	bool fUseInterrupts;
+	uint8_t fIrqLevel;
+	uint16_t fEventsPerInterrupt;
+	uint32_t fIrqTimeout; // in ms
+
+	bool fParallelSetup;
+
+	// settings a board was last programmed with, including the global settings that are programmed per board
+	struct ProgrammedSettings {
+		bool fValid;
+		BoardSettings fBoardSettings;
+		bool fUseExternalClock;
+		bool fUseInterrupts;
+		uint8_t fIrqLevel;
+		uint16_t fEventsPerInterrupt;
+		ProgrammedSettings() : fValid(false) {}
+	};
+	std::vector<ProgrammedSettings> fProgrammed;
+
+	bool fThreadedReadout;
+	int fRingBufferSlots;
+	bool fZeroCopy;
 
 	bool fDebug;
 };
@@ -17,6 +17,7 @@ $Id$
 #include <stdint.h>
 #include <sys/time.h>
 #include <assert.h>
+#include <algorithm>
 #include "midas.h"
 
 #include "CaenDigitizer.hh"
@@ -39,13 +40,13 @@ extern "C" {
 /* a frontend status page is displayed with this frequency in ms */
    INT display_period = 000;
 
-/* maximum event size produced by this frontend */
+/* maximum event size produced by this frontend, adjusted to the board configuration in frontend_init */
    INT max_event_size = 1000*1024;
 
 /* maximum event size for fragmented events (EQ_FRAGMENTED) */
    INT max_event_size_frag = 1024*1024;
 
-/* buffer size to hold events */
+/* buffer size to hold events, adjusted together with max_event_size */
    INT event_buffer_size = 2000*1024;
 
   extern INT run_state;
@@ -121,6 +122,29 @@ extern "C" {
 
 CaenDigitizer* gDigitizer;
 
+// maximum time in ms the stop transition waits for the data already read from the boards to be sent
+const DWORD gDrainTimeout = 10000;
+DWORD gDrainStart = 0;
+
+// deferred stop transition: the readout is stopped first, but the run stays running (so read_event is still polled)
+// until the ring buffers and any split readouts have been sent, only then end_of_run is called
+BOOL wait_for_drain(INT transition, BOOL first)
+{
+	if(first) {
+		gDigitizer->StopReadout();
+		gDrainStart = ss_millitime();
+	}
+	if(!gDigitizer->DataLeft()) {
+		return TRUE;
+	}
+	if(ss_millitime() - gDrainStart > gDrainTimeout) {
+		// whatever is left is reported as lost by StopAcquisition in end_of_run
+		cm_msg(MERROR, "wait_for_drain", "Data left after waiting %u ms for the readout to be sent, stopping anyway", gDrainTimeout);
+		return TRUE;
+	}
+	return FALSE;
+}
+
 /*-- Frontend Init -------------------------------------------------*/
 
 INT frontend_init()
@@ -130,8 +154,24 @@ INT frontend_init()
 
   delete gDigitizer;
   gDigitizer = new CaenDigitizer(hDB, false);
+
+  // size the events so a full readout of all boards fits into one, but at most half of the SYSTEM buffer
+  // readouts that don't fit are split across several events (at board aggregate boundaries),
+  // so the only hard limit is that the largest board aggregate has to fit
+  DWORD systemBufferSize = 32*1024*1024;
+  INT size = sizeof(systemBufferSize);
+  db_get_value(hDB, 0, "/Experiment/Buffer sizes/SYSTEM", &systemBufferSize, &size, TID_DWORD, FALSE);
+  uint32_t eventSize = std::min(gDigitizer->WorstCaseEventSize(), static_cast<uint32_t>(systemBufferSize/2));
+  eventSize = std::max(eventSize, gDigitizer->MinimumEventSize());
+  // round up to full kB
+  max_event_size = ((eventSize + 1023)/1024)*1024;
+  event_buffer_size = std::max(event_buffer_size, 2*max_event_size);
+  cm_msg(MINFO, "frontend_init", "Maximum event size %d bytes (full readout %u bytes), event buffer size %d bytes", max_event_size, gDigitizer->WorstCaseEventSize(), event_buffer_size);
+  gDigitizer->MaxEventSize(max_event_size);
   gDigitizer->Calibrate();
 
+  cm_register_deferred_transition(TR_STOP, wait_for_drain);
+
   return SUCCESS;
 }
 
@@ -150,7 +190,12 @@ INT begin_of_run(INT run_number, char *error)
 {
   printf("begin run %d\n",run_number);
 
-  gDigitizer->StartAcquisition(hDB);
+  gDigitizer->StartAcquisition(hDB, run_number);
+
+  // the settings might have changed since the event size was set in frontend_init
+  if(gDigitizer->MinimumEventSize() > static_cast<uint32_t>(max_event_size)) {
+    cm_msg(MERROR, "begin_of_run", "Board aggregates of up to %u bytes don't fit into maximum event size of %d bytes, data will be lost, please restart the frontend", gDigitizer->MinimumEventSize(), max_event_size);
+  }
 
   return SUCCESS;
 }
@@ -210,12 +255,28 @@ extern "C" INT poll_event(INT source, INT count, BOOL test)
 	is available. If test equals TRUE, don't return. The test
 	flag is used to time the polling */
 {
-	// we can only read more data (which happens in DataReady)
-	// if we have read the previous data
-	if(!gotData) {
-		gotData = gDigitizer->DataReady();
+	// with threaded readout or interrupts we can block until the boards have data,
+	// instead of spinning, the timeout makes sure we get back to the MIDAS main loop
+	if(!test && gDigitizer->CanWaitForData()) {
+		if(!gotData) {
+			gotData = gDigitizer->WaitForData(10);
+		}
+		return gotData;
+	}
+	// DataReady only checks the status registers of the boards, the data
+	// itself is transferred in read_event, so this is cheap enough to be
+	// called count times (as is done when timing the polling in test mode)
+	for(int i = 0; i < count; ++i) {
+		// we can only read more data if we have read the previous data
+		// in test mode we always check, so the timing is correct
+		if(!gotData || test) {
+			gotData = gDigitizer->DataReady();
+		}
+		if(gotData && !test) {
+			return TRUE;
+		}
 	}
-	return gotData;
+	return FALSE;
 }
 
 /*-- Interrupt configuration ---------------------------------------*/
@@ -246,6 +307,12 @@ INT read_event(char *pevent, INT off)
 
 		uint32_t nofEvents = gDigitizer->ReadData(pevent, "CAEN");
 
+		if(nofEvents == 0) {
+			// the boards reported data, but the transfer didn't return any, so there is no event
+			gotData = false;
+			return 0;
+		}
+
 		if(nofEvents > 1) {
 			SERIAL_NUMBER(pevent) += nofEvents - 1;
 		}